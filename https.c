@@ -14,10 +14,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 
 #define BUFFER_USE_BIT  0x10000000
 #define BUFFER_ID(x)    (x & 0x0FFFFFFF)
 
+// the most a Content-Length can presize a read buffer to, beyond this the doubling takes over
+#define PRESIZE_LIMIT   0x40000000
+
 #define _ENTER_     pthread_mutex_lock(&con.mainLock);
 #define __EXIT_     pthread_mutex_unlock(&con.mainLock);
 #define _EXIT_RET(x)    { pthread_mutex_unlock(&con.mainLock); return x; }
@@ -26,6 +30,70 @@
 
 httpsMemoryInterface mem = { malloc, calloc, realloc, free };
 
+// read buffers come in size classes so they can be recycled rather than going back to malloc,
+// class i is POOL_MIN_BYTES << (2 * i): 16K 64K 256K 1M, anything larger is plain malloc/realloc
+#define POOL_CLASSES        4
+#define POOL_MIN_BYTES      16384
+#define POOL_MAX_BYTES      (POOL_MIN_BYTES << (2 * (POOL_CLASSES - 1)))
+#define POOL_THREAD_CACHE   8       // buffers per class a thread keeps to itself
+#define POOL_DEPOT_LIMIT    64      // buffers per class kept in the shared depot
+
+// response sizes are learned per endpoint (host + first path segment) in a small direct mapped
+// table, a request starts with room for mean + 2 deviations once an endpoint has a few samples
+#define SIZE_TABLE_ENTRIES  256
+#define SIZE_MIN_SAMPLES    3
+#define SIZE_WEIGHT         0.125   // weight of a new sample in the moving averages
+
+typedef struct _sizeEntry {
+    unsigned long long key;         // 0 when unused
+    char endpoint[64];
+    double mean;
+    double deviation;
+    unsigned int samples;
+} sizeEntry;
+
+// an idle pooled buffer, the link lives in the buffer itself
+typedef struct _poolBuffer {
+    struct _poolBuffer *next;
+} poolBuffer;
+
+// per request metadata (the URL, a copied post body, request options) is bump allocated, from
+// space in the request itself first, and all of it goes when the request is deleted
+#define ARENA_INLINE_BYTES  512
+#define ARENA_CHUNK_BYTES   4096
+
+typedef struct _arenaChunk {
+    struct _arenaChunk *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} arenaChunk;
+
+// admission queue: waiting requests go by priority class, then deadline (a request without one gets
+// SCHEDULE_HORIZON seconds from when it was made), then submission order
+#define SCHEDULE_CLASSES    2
+#define SCHEDULE_HORIZON    30.0
+#define SCHEDULE_SCAN       64      // most requests started, or looked past for a full host, per class in one pass
+#define HOST_TABLE_ENTRIES  1024    // transfers running per host, hosts that share an entry share the count
+
+// a piece of a HTTPS_CHUNK_BUFFER body, chunks never move once written so pointers into them stay good
+typedef struct _httpsChunk {
+    struct _httpsChunk *next;
+    unsigned int end;
+    unsigned char data[HTTPS_CHUNK_BYTES];
+} httpsChunk;
+
+// a request template, see httpsPrepare()
+typedef struct _httpsPrepared {
+    naettReq *request;              // method, headers and url built once, every fire is made from it
+    char *URL;
+    unsigned int URLBytes;
+    unsigned long long endpoint;    // size table key, worked out once
+    char *body;                     // the prepared body, a fire can bring its own instead
+    unsigned int bodyBytes;
+    int refs;                       // the owner plus every request fired from it
+} httpsPrepared;
+
 typedef struct _httpsReq {
     void *request;
     void *res;
@@ -33,6 +101,7 @@ typedef struct _httpsReq {
     int index;
     int flags;
     char *URL;
+    unsigned long long endpoint;    // size table key, 0 when this request's size isn't learned from
     memBuffer buffer;
     bool complete;
     bool finished;
@@ -43,31 +112,102 @@ typedef struct _httpsReq {
     unsigned int contentTotalBytes;
     char *contentMimeType;
     char *body;
+    httpsPrepared *prepared;        // the template this request was fired from, if any
     void *userData;
     httpsHeaderLister lister;
     httpsFlush flush;
+    // streamed requests hand the body to this instead of buffering it
+    httpsSink sink;
+    void *sinkUser;
+    // chunked bodies, linked and measured under the request mutex
+    httpsChunk *chunkHead;
+    httpsChunk *chunkTail;
+    int chunkCount;
+    // small bodies never leave the request (buffer points here, marked foreign, until it grows)
+    unsigned char inlineData[HTTPS_INLINE_BYTES];
+    // metadata arena, the inline part first then chunks
+    arenaChunk *arena;
+    size_t arenaUsed;
+    unsigned char arenaInline[ARENA_INLINE_BYTES];
     // metrics
     double startTime;
+    // admission
+    unsigned int host;              // host hash, see _hostKey()
+    double deadline;                // when it should have started by, on the _getSeconds() clock
+    unsigned long long seq;         // submission order
+    int queueSlot;                  // heap position while it waits for room, -1 otherwise
+    bool running;                   // counted against the limits until it completes
+    // request table bookkeeping
+    bool live;
+    int nextFree;
+    // pending REQ_EVENT_* bits, nonzero while the request sits on the event list
+    unsigned int events;
+    struct _httpsReq *nextEvent;
 } httpsReq;
 
+// state changes the transport thread publishes for httpsUpdate to pick up
+#define REQ_EVENT_HEADERS   1
+#define REQ_EVENT_READ      2
+#define REQ_EVENT_COMPLETE  4
+#define REQ_EVENT_FINISHED  8
+
 typedef struct _httpsContext {
     unsigned int bufferSize;
     unsigned long bufferBytes;
     int requestCount;
     int persistentBufferCount;
     pthread_mutex_t mainLock;
-    httpsReq* requestTable[MAX_REQUEST];
+    // requests live in slabs that are never moved or freed, so handles and pointers stay stable
+    httpsReq* requestSlab[MAX_REQUEST_SLABS];
+    int requestCapacity;
+    // lock-free free list of slots: (ABA tag << 32) | (index + 1), 0 when empty
+    unsigned long long freeHead;
+    // lock-free list of requests with new events, pushed by any thread and drained by httpsUpdate
+    httpsReq* eventHead;
+    // handles httpsUpdate saw events for on its last pass, so easyUpdate can skip quiet requests
+    int* touched;
+    int touchedCount;
+    int touchedCapacity;
+    // called when the event list goes from empty to not, from whatever thread posted
+    void (*notify)();
     memBuffer* persistentBuffer;
-    httpsReq requestBacker[MAX_REQUEST];
     httpsFlush flush;
+    // idle body chunks, shared by every transport thread
+    pthread_mutex_t chunkLock;
+    httpsChunk *chunkFree;
+    int chunkFreeCount;
+    // read buffers the thread caches overflowed into, per size class
+    pthread_mutex_t poolLock;
+    struct _poolBuffer *poolDepot[POOL_CLASSES];
+    int poolDepotCount[POOL_CLASSES];
+    struct _poolCache *poolCaches;  // every thread's cache, so cleanup can take them back
+    long long poolHits;
+    long long poolMisses;
+    // learned response sizes
+    pthread_mutex_t sizeLock;
+    sizeEntry sizeTable[SIZE_TABLE_ENTRIES];
+    // admission, what is running against the limits and what waits for room (a min heap per priority class)
+    pthread_mutex_t scheduleLock;
+    int activeLimit;
+    int hostLimit;
+    int activeCount;
+    int hostActive[HOST_TABLE_ENTRIES];
+    struct _httpsReq **queue[SCHEDULE_CLASSES];
+    int queueCount[SCHEDULE_CLASSES];
+    int queueCapacity[SCHEDULE_CLASSES];
+    unsigned long long scheduleSeq;
 } httpsContext;
 
 httpsContext con = { 0, 0, 0, 0 };
+unsigned int _requestReserve = MAX_REQUEST;
+int _activeLimit = HTTPS_ACTIVE_LIMIT;
+int _hostLimit = 0;
 
+// monotonic, everything that uses it wants intervals (metrics, deadlines, progress throttling)
 static inline double _getSeconds() {
-    struct timeval currentTime;
-    gettimeofday(&currentTime, NULL);
-    return (double)currentTime.tv_sec + (double)currentTime.tv_usec * 0.0000001;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
 }
 
 static inline char *memStrdup(const char *str) {
@@ -78,43 +218,353 @@ static inline char *memStrdup(const char *str) {
     return ret;
 }
 
-httpsReq* _newHttpsReq(int flags) {
-    httpsReq* req = NULL;
-    int i;
+// per thread, so the common take and give never touch a lock
+typedef struct _poolCache {
+    poolBuffer *head[POOL_CLASSES];
+    int count[POOL_CLASSES];
+    struct _poolCache *next;        // on con.poolCaches
+} poolCache;
+
+// this thread's cache and the cleanup it was made after, httpsCleanup() frees every cache
+// (transport and easy workers fill theirs too) and bumps the epoch so threads make new ones
+static xthread_local poolCache *_poolLocal;
+static xthread_local unsigned int _poolLocalEpoch;
+static unsigned int _poolEpoch = 1;
+
+static poolCache* _poolCache() {
+    unsigned int epoch = xatomic_load(&_poolEpoch);
+    if ((_poolLocal != NULL) && (_poolLocalEpoch == epoch)) return _poolLocal;
+    poolCache *t = mem.calloc(1, sizeof(poolCache));
+    if (t == NULL) return NULL;
+    pthread_mutex_lock(&con.poolLock);
+    t->next = con.poolCaches;
+    con.poolCaches = t;
+    pthread_mutex_unlock(&con.poolLock);
+    _poolLocal = t;
+    _poolLocalEpoch = epoch;
+    return t;
+}
 
-    _ENTER_
+// the size a buffer of at least length bytes is really allocated at
+static inline unsigned long _poolRound(unsigned long length) {
+    unsigned long size = POOL_MIN_BYTES;
+    if (length > POOL_MAX_BYTES) return length;
+    while (size < length) size <<= 2;
+    return size;
+}
+
+// the class a buffer of exactly length bytes belongs to, or -1
+static inline int _poolClass(unsigned long length) {
+    unsigned long size = POOL_MIN_BYTES;
+    for (int c = 0; c < POOL_CLASSES; c++, size <<= 2) if (size == length) return c;
+    return -1;
+}
+
+// a buffer of length bytes (length from _poolRound), from this thread's cache or the depot if possible
+static unsigned char* _poolTake(unsigned long length) {
+    int c = _poolClass(length);
+    poolCache *t = (c < 0) ? NULL : _poolCache();
+    poolBuffer *b;
+    if (t == NULL) return mem.malloc(length);
+    if (t->head[c] == NULL) {
+        // refill half a cache's worth in one go
+        pthread_mutex_lock(&con.poolLock);
+        while ((con.poolDepot[c] != NULL) && (t->count[c] < POOL_THREAD_CACHE / 2)) {
+            b = con.poolDepot[c];
+            con.poolDepot[c] = b->next;
+            con.poolDepotCount[c]--;
+            b->next = t->head[c];
+            t->head[c] = b;
+            t->count[c]++;
+        }
+        pthread_mutex_unlock(&con.poolLock);
+    }
+    b = t->head[c];
+    if (b == NULL) {
+        xatomic_add(&con.poolMisses, 1);
+        return mem.malloc(length);
+    }
+    t->head[c] = b->next;
+    t->count[c]--;
+    xatomic_add(&con.poolHits, 1);
+    return (unsigned char*)b;
+}
+
+// hand a buffer back, a full thread cache spills half into the depot and a full depot frees
+static void _poolGive(unsigned char *data, unsigned long length) {
+    int c = _poolClass(length);
+    poolCache *t = (c < 0) ? NULL : _poolCache();
+    poolBuffer *b = (poolBuffer*)data;
+    if (data == NULL) return;
+    if (t == NULL) {
+        mem.free(data);
+        return;
+    }
+    b->next = t->head[c];
+    t->head[c] = b;
+    if (++t->count[c] <= POOL_THREAD_CACHE) return;
+    pthread_mutex_lock(&con.poolLock);
+    while (t->count[c] > POOL_THREAD_CACHE / 2) {
+        b = t->head[c];
+        t->head[c] = b->next;
+        t->count[c]--;
+        if (con.poolDepotCount[c] < POOL_DEPOT_LIMIT) {
+            b->next = con.poolDepot[c];
+            con.poolDepot[c] = b;
+            con.poolDepotCount[c]++;
+        } else mem.free(b);
+    }
+    pthread_mutex_unlock(&con.poolLock);
+}
+
+// grow a read buffer to at least length bytes, keeping what it holds; false leaves it as it was
+static bool _growBuffer(memBuffer *p, unsigned long length) {
+    unsigned char *grown;
+    length = _poolRound(length);
+    if (p->index & HTTPS_MEMBUFFER_FOREIGN) {
+        // spilling out of a request's inline bytes, which aren't ours to free
+        grown = _poolTake(length);
+        if (grown == NULL) return false;
+        memcpy(grown, p->data, p->end);
+        p->index &= ~HTTPS_MEMBUFFER_FOREIGN;
+    } else if ((_poolClass(length) < 0) && (_poolClass(p->length) < 0)) {
+        // big buffers, realloc can often extend in place
+        grown = mem.realloc(p->data, length);
+    } else {
+        grown = _poolTake(length);
+        if (grown == NULL) return false;
+        memcpy(grown, p->data, p->end);
+        _poolGive(p->data, p->length);
+    }
+    if (grown == NULL) return false;
+    xatomic_add(&con.bufferBytes, length - p->length);
+    p->data = grown;
+    p->length = length;
+    return true;
+}
+
+// the endpoint part of a URL, scheme://host/segment, as a key (never 0) and optionally its text
+static unsigned long long _endpointKey(const char *URL, char *text, int textBytes) {
+    const char *s = strstr(URL, "://");
+    unsigned long long h = 14695981039346656037ULL;
+    int slashes = 0, n = 0;
+    s = (s != NULL) ? s + 3 : URL;
+    for (; *s && (*s != '?') && (*s != '#'); s++) {
+        if ((*s == '/') && (++slashes == 2)) break;
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+        if ((text != NULL) && (n < textBytes - 1)) text[n++] = *s;
+    }
+    if (text != NULL) text[n] = 0;
+    return h ? h : 1;
+}
+
+// the initial buffer size for an endpoint, 0 when there is nothing to go on yet
+static unsigned long _sizeHint(unsigned long long key) {
+    sizeEntry *e = &con.sizeTable[key % SIZE_TABLE_ENTRIES];
+    unsigned long hint = 0;
+    pthread_mutex_lock(&con.sizeLock);
+    if ((e->key == key) && (e->samples >= SIZE_MIN_SAMPLES)) hint = (unsigned long)(e->mean + 2.0 * e->deviation) + 1;
+    pthread_mutex_unlock(&con.sizeLock);
+    return hint;
+}
+
+// fold a finished body into its endpoint's estimate, a different endpoint in the same entry replaces it
+static void _sizeSample(httpsReq *r) {
+    sizeEntry *e = &con.sizeTable[r->endpoint % SIZE_TABLE_ENTRIES];
+    double bytes = (double)r->readTotalBytes;
+    pthread_mutex_lock(&con.sizeLock);
+    if (e->key != r->endpoint) {
+        e->key = r->endpoint;
+        _endpointKey(r->URL, e->endpoint, sizeof(e->endpoint));
+        e->mean = bytes;
+        e->deviation = bytes * 0.5;
+        e->samples = 1;
+    } else {
+        double diff = bytes - e->mean;
+        e->deviation += SIZE_WEIGHT * (((diff < 0.0) ? -diff : diff) - e->deviation);
+        e->mean += SIZE_WEIGHT * diff;
+        e->samples++;
+    }
+    pthread_mutex_unlock(&con.sizeLock);
+}
+
+int httpsGetSizeEstimates(httpsSizeEstimate *out, int max) {
+    int count = 0;
+    pthread_mutex_lock(&con.sizeLock);
+    for (int i = 0; i < SIZE_TABLE_ENTRIES; i++) {
+        sizeEntry *e = &con.sizeTable[i];
+        if (e->key == 0) continue;
+        if (count < max) {
+            httpsSizeEstimate *s = &out[count];
+            memcpy(s->endpoint, e->endpoint, sizeof(s->endpoint));
+            s->meanBytes = e->mean;
+            s->deviationBytes = e->deviation;
+            s->samples = e->samples;
+            s->initialBytes = HTTPS_INLINE_BYTES;
+            if (e->samples >= SIZE_MIN_SAMPLES) {
+                unsigned long hint = (unsigned long)(e->mean + 2.0 * e->deviation) + 1;
+                if (hint > HTTPS_INLINE_BYTES) s->initialBytes = _poolRound(hint);
+            }
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&con.sizeLock);
+    return count;
+}
+
+// bump allocate from a request's arena, it is all freed at once by _arenaReset()
+static void* _arenaAlloc(httpsReq *r, size_t bytes) {
+    arenaChunk *c = r->arena;
+    void *p;
+    bytes = (bytes + 7) & ~(size_t)7;
+    if (r->arenaUsed + bytes <= ARENA_INLINE_BYTES) {
+        p = r->arenaInline + r->arenaUsed;
+        r->arenaUsed += bytes;
+        return p;
+    }
+    if ((c == NULL) || (c->size - c->used < bytes)) {
+        size_t size = (bytes > ARENA_CHUNK_BYTES) ? bytes : ARENA_CHUNK_BYTES;
+        c = mem.malloc(sizeof(arenaChunk) + size);
+        if (c == NULL) return NULL;
+        c->size = size;
+        c->used = 0;
+        c->next = r->arena;
+        r->arena = c;
+    }
+    p = c->data + c->used;
+    c->used += bytes;
+    return p;
+}
+
+static char* _arenaStrdup(httpsReq *r, const char *str, size_t bytes) {
+    char *ret = _arenaAlloc(r, bytes + 1);
+    if (ret == NULL) return NULL;
+    memcpy(ret, str, bytes);
+    ret[bytes] = 0;
+    return ret;
+}
+
+static void _arenaReset(httpsReq *r) {
+    while (r->arena != NULL) {
+        arenaChunk *next = r->arena->next;
+        mem.free(r->arena);
+        r->arena = next;
+    }
+    r->arenaUsed = 0;
+}
+
+static inline httpsReq* _reqAt(int i) {
+    return con.requestSlab[i / REQUEST_SLAB_SIZE] + (i % REQUEST_SLAB_SIZE);
+}
+
+// the live request with handle i, or NULL
+static inline httpsReq* _liveReq(int i) {
+    httpsReq *r;
+    if ((i < 0) || (i >= xatomic_load(&con.requestCapacity))) return NULL;
+    r = _reqAt(i);
+    return r->live ? r : NULL;
+}
+
+static void _pushFreeReq(httpsReq *r) {
+    unsigned long long head = xatomic_load(&con.freeHead), next;
+    do {
+        xatomic_store(&r->nextFree, (int)(head & 0xFFFFFFFF) - 1);
+        next = (((head >> 32) + 1) << 32) | (unsigned int)(r->index + 1);
+    } while (!xatomic_cas(&con.freeHead, &head, next));
+}
+
+static httpsReq* _popFreeReq() {
+    unsigned long long head = xatomic_load(&con.freeHead), next;
+    while (head & 0xFFFFFFFF) {
+        // slabs are never freed, so peeking at a slot another thread just took is harmless,
+        // the tag makes our swap fail in that case
+        httpsReq *r = _reqAt((int)(head & 0xFFFFFFFF) - 1);
+        next = (((head >> 32) + 1) << 32) | (unsigned int)(xatomic_load(&r->nextFree) + 1);
+        if (xatomic_cas(&con.freeHead, &head, next)) return r;
+    }
+    return NULL;
+}
+
+// add slabs until we have at least count slots, call holding mainLock
+static bool _growRequests(unsigned int count) {
+    if (count > MAX_REQUEST_LIMIT) count = MAX_REQUEST_LIMIT;
+    while (con.requestCapacity < (int)count) {
+        int base = con.requestCapacity;
+        httpsReq *slab = mem.calloc(REQUEST_SLAB_SIZE, sizeof(httpsReq));
+        if (slab == NULL) return false;
+        con.requestSlab[base / REQUEST_SLAB_SIZE] = slab;
+        xatomic_store(&con.requestCapacity, base + REQUEST_SLAB_SIZE);
+        // push in reverse so low handles get used first
+        for (int i = REQUEST_SLAB_SIZE - 1; i >= 0; i--) {
+            slab[i].index = base + i;
+            _pushFreeReq(&slab[i]);
+        }
+    }
+    return true;
+}
 
-    for (i = 0; i < MAX_REQUEST; i++)
-        if (con.requestTable[i] == NULL) break;
+// endpoint is the size table key when the caller already has it, 0 to work it out from the URL
+static httpsReq* _newHttpsReqKeyed(const char *URL, int flags, unsigned long long endpoint) {
+    httpsReq* req = _popFreeReq();
+    unsigned long hint;
 
-    if (i == MAX_REQUEST) _EXIT_RET(NULL)
+    if (req == NULL) {
+        // out of slots, grow the table by a slab unless another thread just did
+        _ENTER_
+        req = _popFreeReq();
+        if ((req == NULL) && _growRequests(con.requestCapacity + REQUEST_SLAB_SIZE)) req = _popFreeReq();
+        __EXIT_
+        if (req == NULL) return NULL;
+    }
 
-    // pull an allocated request and make it live in the system
-    req = con.requestTable[i] = &con.requestBacker[i];
     // properly configure the request
-    req->index = i;
     req->flags = flags;
-    if (flags & HTTPS_FIXED_BUFFER) {
+    req->endpoint = 0;
+    if (flags & (HTTPS_STREAM | HTTPS_CHUNK_BUFFER)) {
+        // nothing to buffer into, or chunks come from the pool as the body arrives
+        memset(&req->buffer, 0, sizeof(memBuffer));
+        req->buffer.index = HTTPS_MEMBUFFER_UNINDEX;
+    } else if (flags & HTTPS_FIXED_BUFFER) {
         // we want a fixed buffer for this request, so reflect that
         req->buffer.index = HTTPS_MEMBUFFER_UNINDEX;
         req->buffer.data = mem.malloc(HTTPS_BUFFER_KB(flags));
-        if (req->buffer.data == NULL) _EXIT_RET(NULL)
         req->buffer.length = HTTPS_BUFFER_KB(flags);
     } else if (flags & HTTPS_FIXED_BUFFER) {
         // we are using a persistent buffer, so make that happen
         memcpy(&req->buffer, &con.persistentBuffer[HTTPS_PERSIST_ID(flags)], sizeof(memBuffer));
+    } else if (!(flags & HTTPS_REUSE_BUFFER) && (HTTPS_DOUBLE_FOREVER(flags) || (flags & HTTPS_DOUBLE_UNTIL))) {
+        // a buffer that can grow starts as big as its endpoint's bodies usually are,
+        // or in the request itself with the first growth spilling to the pool
+        req->endpoint = (endpoint != 0) ? endpoint : _endpointKey(URL, NULL, 0);
+        hint = _sizeHint(req->endpoint);
+        if (hint > HTTPS_INLINE_BYTES) {
+            req->buffer.index = HTTPS_MEMBUFFER_UNINDEX;
+            req->buffer.length = _poolRound(hint);
+            req->buffer.data = _poolTake(req->buffer.length);
+        } else {
+            req->buffer.index = HTTPS_MEMBUFFER_UNINDEX | HTTPS_MEMBUFFER_FOREIGN;
+            req->buffer.data = req->inlineData;
+            req->buffer.length = HTTPS_INLINE_BYTES;
+        }
     } else {
-        // allocate a buffer for this locally
+        // reused buffers flush each time they fill, so they keep the full size (from the pool)
         req->buffer.index = HTTPS_MEMBUFFER_UNINDEX;
-        req->buffer.data = mem.malloc(con.bufferSize);
-        if (req->buffer.data == NULL) _EXIT_RET(NULL)
-        req->buffer.length = con.bufferSize;
+        req->buffer.length = _poolRound(con.bufferSize);
+        req->buffer.data = _poolTake(req->buffer.length);
     }
-    con.bufferBytes += req->buffer.length;
-
-    __EXIT_ // exit early because we are done with the global state
+    if ((req->buffer.data == NULL) && !(flags & (HTTPS_STREAM | HTTPS_CHUNK_BUFFER))) {
+        _pushFreeReq(req);
+        return NULL;
+    }
+    xatomic_add(&con.bufferBytes, req->buffer.length);
+    xatomic_add(&con.requestCount, 1);
 
     pthread_mutex_init((pthread_mutex_t*)&req->mutex, NULL);
+    req->arena = NULL;
+    req->arenaUsed = 0;
+    req->URL = _arenaStrdup(req, URL, strlen(URL));
+    req->body = NULL;
+    req->prepared = NULL;
     req->headerDone = req->complete = req->finished = false;
     req->flush = con.flush;
     req->buffer.end = 0;
@@ -125,32 +575,397 @@ httpsReq* _newHttpsReq(int flags) {
     req->contentTotalBytes = 0;
     req->contentMimeType = NULL;
     req->userData = NULL;
+    req->sink = NULL;
+    req->sinkUser = NULL;
+    req->chunkHead = req->chunkTail = NULL;
+    req->chunkCount = 0;
+    req->events = 0;
+    req->nextEvent = NULL;
+    req->host = 0;
+    req->deadline = 0.0;
+    req->queueSlot = -1;
+    req->running = false;
+    // make it live in the system
+    xatomic_store(&req->live, true);
 
     return req;
 }
 
+httpsReq* _newHttpsReq(const char *URL, int flags) {
+    return _newHttpsReqKeyed(URL, flags, 0);
+}
+
+// the owner or a request fired from it is done with a template, the last one out frees it
+static void _preparedDrop(httpsPrepared *t) {
+    if (xatomic_sub(&t->refs, 1) != 1) return;
+    naettFree(t->request);
+    mem.free(t);
+}
+
+// a chunk from the pool, or a new one when it is empty
+static httpsChunk* _takeChunk() {
+    httpsChunk *c;
+    pthread_mutex_lock(&con.chunkLock);
+    c = con.chunkFree;
+    if (c != NULL) {
+        con.chunkFree = c->next;
+        con.chunkFreeCount--;
+    }
+    pthread_mutex_unlock(&con.chunkLock);
+    if (c == NULL) c = mem.malloc(sizeof(httpsChunk));
+    if (c == NULL) return NULL;
+    c->next = NULL;
+    c->end = 0;
+    xatomic_add(&con.bufferBytes, HTTPS_CHUNK_BYTES);
+    return c;
+}
+
+// hand a list of chunks back, the pool keeps up to MAX_POOLED_CHUNKS and frees the rest
+static void _giveChunks(httpsChunk *c) {
+    while (c != NULL) {
+        httpsChunk *next = c->next;
+        xatomic_sub(&con.bufferBytes, HTTPS_CHUNK_BYTES);
+        pthread_mutex_lock(&con.chunkLock);
+        if (con.chunkFreeCount < MAX_POOLED_CHUNKS) {
+            c->next = con.chunkFree;
+            con.chunkFree = c;
+            con.chunkFreeCount++;
+            c = NULL;
+        }
+        pthread_mutex_unlock(&con.chunkLock);
+        mem.free(c);
+        c = next;
+    }
+}
+
 void _delHttpsReq(httpsReq *p) {
-    con.requestTable[p->index] = NULL;
+    xatomic_store(&p->live, false);
+    // chunked bodies go back to the pool
+    _giveChunks(p->chunkHead);
+    p->chunkHead = p->chunkTail = NULL;
     // free read buffer
-    if (p->flags & HTTPS_PERSISTENT_BUFFER) {
-        // users manage this, so we do nothing
+    if ((p->flags & HTTPS_PERSISTENT_BUFFER) || (p->buffer.index & HTTPS_MEMBUFFER_FOREIGN)) {
+        // users manage this (or it is the inline area), so we do nothing
     } else {
-        // just free the allocated buffer for this request
-        mem.free(p->buffer.data);    
+        // the allocated buffer for this request goes back to the pool
+        _poolGive(p->buffer.data, p->buffer.length);
     }
-    con.bufferBytes -= p->buffer.length;
+    xatomic_sub(&con.bufferBytes, p->buffer.length);
     // free the mutex
     pthread_mutex_destroy((pthread_mutex_t*)&p->mutex);
-    // free the request itself
-    naettClose((naettRes*)p->res);
-    naettFree((naettReq*)p->request);
+    // free the request itself (one that never left the queue has no response)
+    if (p->res != NULL) naettClose((naettRes*)p->res);
+    if (p->request != NULL) naettFree((naettReq*)p->request);
+    if (p->prepared != NULL) _preparedDrop(p->prepared);
+    p->prepared = NULL;
+    // the URL, a copied body and the rest of the metadata
+    _arenaReset(p);
+    // and hand the slot back
+    xatomic_sub(&con.requestCount, 1);
+    _pushFreeReq(p);
+}
+
+// FNV-1a over the lowercased host and port, past any user info
+static unsigned int _hostKey(const char *URL) {
+    const char *p = strstr(URL, "://");
+    const char *q, *at = NULL;
+    unsigned int hash = 2166136261u;
+    p = (p != NULL) ? p + 3 : URL;
+    for (q = p; *q && (*q != '/') && (*q != '?') && (*q != '#'); q++) if (*q == '@') at = q;
+    if (at != NULL) p = at + 1;
+    for (; *p && (*p != '/') && (*p != '?') && (*p != '#'); p++) {
+        hash ^= (unsigned int)tolower((unsigned char)*p);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline int _scheduleClass(httpsReq *r) {
+    return (r->flags & HTTPS_BACKGROUND) ? 1 : 0;
+}
+
+// the rest of this section runs with scheduleLock held
+
+// room for one more of a class, background leaves a quarter of the limit to interactive requests
+static inline bool _classRoom(int c) {
+    int limit = con.activeLimit;
+    if (limit <= 0) return true;
+    if (c > 0) limit -= limit / 4;
+    return con.activeCount < limit;
+}
+
+static inline bool _hostRoom(httpsReq *r) {
+    return (con.hostLimit <= 0) || (con.hostActive[r->host % HOST_TABLE_ENTRIES] < con.hostLimit);
+}
+
+static inline void _run(httpsReq *r) {
+    r->running = true;
+    con.activeCount++;
+    con.hostActive[r->host % HOST_TABLE_ENTRIES]++;
+}
+
+static inline bool _scheduleBefore(httpsReq *a, httpsReq *b) {
+    if (a->deadline != b->deadline) return a->deadline < b->deadline;
+    return a->seq < b->seq;
+}
+
+static inline void _heapSet(int c, int i, httpsReq *r) {
+    con.queue[c][i] = r;
+    r->queueSlot = i;
+}
+
+static void _heapUp(int c, int i) {
+    httpsReq *r = con.queue[c][i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!_scheduleBefore(r, con.queue[c][parent])) break;
+        _heapSet(c, i, con.queue[c][parent]);
+        i = parent;
+    }
+    _heapSet(c, i, r);
+}
+
+static void _heapDown(int c, int i) {
+    httpsReq *r = con.queue[c][i];
+    int count = con.queueCount[c];
+    while (i * 2 + 1 < count) {
+        int child = i * 2 + 1;
+        if ((child + 1 < count) && _scheduleBefore(con.queue[c][child + 1], con.queue[c][child])) child++;
+        if (!_scheduleBefore(con.queue[c][child], r)) break;
+        _heapSet(c, i, con.queue[c][child]);
+        i = child;
+    }
+    _heapSet(c, i, r);
+}
+
+static bool _heapPush(int c, httpsReq *r) {
+    if (con.queueCount[c] == con.queueCapacity[c]) {
+        int capacity = con.queueCapacity[c] ? con.queueCapacity[c] * 2 : MAX_REQUEST;
+        httpsReq **grown = mem.realloc(con.queue[c], sizeof(httpsReq*) * capacity);
+        if (grown == NULL) return false;
+        con.queue[c] = grown;
+        con.queueCapacity[c] = capacity;
+    }
+    _heapSet(c, con.queueCount[c]++, r);
+    _heapUp(c, r->queueSlot);
+    return true;
+}
+
+static void _heapRemove(int c, int i) {
+    httpsReq *r = con.queue[c][i];
+    httpsReq *last = con.queue[c][--con.queueCount[c]];
+    r->queueSlot = -1;
+    if (last == r) return;
+    _heapSet(c, i, last);
+    _heapUp(c, i);
+    _heapDown(c, last->queueSlot);
+}
+
+// done with scheduleLock
+
+// over to the transport, in one go when there are several
+static void _startMany(httpsReq **reqs, int n) {
+    if (n == 0) return;
+    naettReq **requests = (n > 1) ? mem.malloc(sizeof(naettReq*) * n * 2) : NULL;
+    if (requests == NULL) {
+        for (int i = 0; i < n; i++) reqs[i]->res = (void*)naettMake((naettReq*)reqs[i]->request);
+        return;
+    }
+    naettRes **responses = (naettRes**)(requests + n);
+    for (int i = 0; i < n; i++) requests[i] = (naettReq*)reqs[i]->request;
+    naettMakeMany(requests, responses, n);
+    for (int i = 0; i < n; i++) reqs[i]->res = (void*)responses[i];
+    mem.free(requests);
+}
+
+// the ones there is room for start now (reqs is packed down to them), the rest wait for httpsUpdate to promote them
+static void _admitMany(httpsReq **reqs, int n) {
+    int started = 0;
+    for (int i = 0; i < n; i++) reqs[i]->host = _hostKey(reqs[i]->URL);
+    pthread_mutex_lock(&con.scheduleLock);
+    for (int i = 0; i < n; i++) {
+        httpsReq *r = reqs[i];
+        int c = _scheduleClass(r);
+        r->seq = con.scheduleSeq++;
+        if (r->deadline == 0.0) r->deadline = r->startTime + SCHEDULE_HORIZON;
+        // room for it now? (anything of its class still waiting is on a full host, promotion starts the rest)
+        if ((_classRoom(c) && _hostRoom(r)) || !_heapPush(c, r)) {
+            _run(r);
+            reqs[started++] = r;
+        }
+    }
+    pthread_mutex_unlock(&con.scheduleLock);
+    _startMany(reqs, started);
+}
+
+static inline void _admit(httpsReq *r) {
+    _admitMany(&r, 1);
+}
+
+// take a request that never started out of the queue, false if it isn't waiting
+static bool _unqueue(httpsReq *r) {
+    bool waiting;
+    pthread_mutex_lock(&con.scheduleLock);
+    waiting = (r->queueSlot >= 0);
+    if (waiting) _heapRemove(_scheduleClass(r), r->queueSlot);
+    pthread_mutex_unlock(&con.scheduleLock);
+    return waiting;
+}
+
+// a transfer finished, its room goes back
+static void _finishRun(httpsReq *r) {
+    if (!r->running) return;
+    pthread_mutex_lock(&con.scheduleLock);
+    r->running = false;
+    con.activeCount--;
+    con.hostActive[r->host % HOST_TABLE_ENTRIES]--;
+    pthread_mutex_unlock(&con.scheduleLock);
+}
+
+// start waiting requests while there is room, interactive first, each class in deadline order
+// (a request whose host is full is looked past and keeps its place)
+// take what fits from queue c into ready using the room class `room` is allowed, with overdue set only
+// the ones whose deadline is before now, returns how many were taken
+static int _promoteQueue(int c, int room, bool overdue, double now, httpsReq **ready) {
+    httpsReq *aside[SCHEDULE_SCAN];
+    int skipped = 0, started = 0;
+    while ((con.queueCount[c] > 0) && _classRoom(room) && (started < SCHEDULE_SCAN) && (skipped < SCHEDULE_SCAN)) {
+        httpsReq *r = con.queue[c][0];
+        // earliest deadline is on top, so once one isn't overdue none of the rest are
+        if (overdue && (r->deadline > now)) break;
+        _heapRemove(c, 0);
+        if (!_hostRoom(r)) {
+            aside[skipped++] = r;
+            continue;
+        }
+        _run(r);
+        ready[started++] = r;
+    }
+    // these were just taken out, so there is room to put them back
+    for (int i = 0; i < skipped; i++) _heapPush(c, aside[i]);
+    return started;
+}
+
+static void _promote() {
+    httpsReq *ready[SCHEDULE_SCAN * (SCHEDULE_CLASSES + 1)];
+    int n;
+    do {
+        double now = _getSeconds();
+        pthread_mutex_lock(&con.scheduleLock);
+        // background past its deadline goes ahead of interactive and may use interactive's room,
+        // so a steady stream of interactive requests can't hold it back forever
+        n = _promoteQueue(1, 0, true, now, ready);
+        for (int c = 0; c < SCHEDULE_CLASSES; c++) n += _promoteQueue(c, c, false, now, ready + n);
+        pthread_mutex_unlock(&con.scheduleLock);
+        _startMany(ready, n);
+    } while (n > 0);
+}
+
+void httpsSetLimits(int active, int perHost) {
+    _activeLimit = active;
+    _hostLimit = perHost;
+    if (con.bufferSize == 0) return;
+    pthread_mutex_lock(&con.scheduleLock);
+    con.activeLimit = active;
+    con.hostLimit = perHost;
+    pthread_mutex_unlock(&con.scheduleLock);
+    // more room? then some of the waiting can go now
+    _promote();
+}
+
+void httpsSetDeadline(void *p, double seconds) {
+    httpsReq *r = (httpsReq*)p;
+    pthread_mutex_lock(&con.scheduleLock);
+    r->deadline = _getSeconds() + seconds;
+    if (r->queueSlot >= 0) {
+        int c = _scheduleClass(r);
+        _heapUp(c, r->queueSlot);
+        _heapDown(c, r->queueSlot);
+    }
+    pthread_mutex_unlock(&con.scheduleLock);
+}
+
+// queue a request for the next httpsUpdate, safe from any thread
+static void _postEvent(httpsReq *r, unsigned int bits) {
+    // already on the list? then the bits just ride along with it
+    if (xatomic_or(&r->events, bits) != 0) return;
+    httpsReq *head = xatomic_load(&con.eventHead);
+    do {
+        r->nextEvent = head;
+    } while (!xatomic_cas(&con.eventHead, &head, r));
+    if ((head == NULL) && (con.notify != NULL)) con.notify();
+}
+
+/*
+    Grow a buffer that can grow to the announced Content-Length (plus a byte, so the last write
+    doesn't trigger a doubling) in one step, before the body starts arriving. Runs on the transport
+    thread like _bodyWriter(), the doubling stays for chunked responses and bad estimates.
+*/
+static void _presizeBuffer(httpsReq *r, naettRes *response) {
+    memBuffer *p = &r->buffer;
+    unsigned long long want;
+    if (r->flags & (HTTPS_FIXED_BUFFER | HTTPS_REUSE_BUFFER | HTTPS_STREAM | HTTPS_CHUNK_BUFFER)) return;
+    if (naettGetHeaderInfo(response)->contentLength < 0) return;
+    want = naettGetHeaderInfo(response)->contentLength + 1;
+    if ((want <= p->length) || (want > PRESIZE_LIMIT)) return;
+    _growBuffer(p, want);
+}
+
+void _eventHandler(int event, naettRes* response, void* userData) {
+    httpsReq *r = (httpsReq*)userData;
+    switch (event) {
+        case naettEventHeaders:
+            _presizeBuffer(r, response);
+            _postEvent(r, REQ_EVENT_HEADERS);
+            break;
+        case naettEventComplete: _postEvent(r, REQ_EVENT_COMPLETE); break;
+    }
+}
+
+/*
+    Append to a chunked body, growth is a chunk off the pool and nothing already written ever moves.
+    Bytes are copied before they are counted, so readers only ever see finished bytes.
+*/
+static int _chunkWriter(httpsReq *r, const char *src, int bytes) {
+    int toWrite = bytes;
+    while (toWrite > 0) {
+        httpsChunk *c = r->chunkTail;
+        if ((c == NULL) || (c->end == HTTPS_CHUNK_BYTES)) {
+            c = _takeChunk();
+            if (c == NULL) return bytes - toWrite;
+            _ENTER_REQ(r)
+            if (r->chunkTail != NULL) r->chunkTail->next = c;
+                else r->chunkHead = c;
+            r->chunkTail = c;
+            r->chunkCount++;
+            _EXIT_REQ(r)
+        }
+        unsigned int nibble = HTTPS_CHUNK_BYTES - c->end;
+        if (nibble > (unsigned int)toWrite) nibble = toWrite;
+        memcpy(c->data + c->end, src, nibble);
+        _ENTER_REQ(r)
+        c->end += nibble;
+        r->readTotalBytes += nibble;
+        _EXIT_REQ(r)
+        toWrite -= nibble;
+        src += nibble;
+    }
+    return bytes;
 }
 
 int _bodyWriter(const void* source, int bytes, void* userData) {
     httpsReq *r = (httpsReq*)userData;
     memBuffer *p = &r->buffer;
     const char* src = (const char*)source;
-    r->headerDone = true;
+    if (r->sink != NULL) {
+        // straight from the transport's buffer, no copy, the event goes after so the sink has it first
+        int written = r->sink(r, src, bytes, r->sinkUser);
+        r->readTotalBytes += written;
+        _postEvent(r, REQ_EVENT_READ);
+        return written;
+    }
+    _postEvent(r, REQ_EVENT_READ);
+    if (r->flags & HTTPS_CHUNK_BUFFER) return _chunkWriter(r, src, bytes);
     int toWrite = bytes;
     int nibble;
     while (toWrite > 0) {
@@ -171,24 +986,15 @@ int _bodyWriter(const void* source, int bytes, void* userData) {
             }
             // if this is a fixed buffer we are done, so close out this writing call
             if (r->flags & HTTPS_FIXED_BUFFER) return 0;
-            // just forever double?
+            // just forever double? (pooled sizes round the step up to the next class)
             if HTTPS_DOUBLE_FOREVER(r->flags) {
-                p->data = mem.realloc(p->data, p->length * 2);
-                if (p->data == NULL) return 0;
-                con.bufferBytes += p->length;
-                p->length *= 2;
+                if (!_growBuffer(p, p->length * 2)) return 0;
             } else {
                 if (r->flags & HTTPS_DOUBLE_UNTIL) {
                     if (p->length < (HTTPS_BUFFER_KB(r->flags) * 1024)) {
-                        p->data = mem.realloc(p->data, p->length * 2);
-                        if (p->data == NULL) return 0;
-                        p->length *= 2;
-                        con.bufferBytes += (p->length >> 1);
+                        if (!_growBuffer(p, p->length * 2)) return 0;
                     } else {
-                        p->data = mem.realloc(p->data, p->length + HTTPS_BUFFER_KB(r->flags) * 1024);
-                        if (p->data == NULL) return 0;
-                        p->length += HTTPS_BUFFER_KB(r->flags) * 1024;
-                        con.bufferBytes += HTTPS_BUFFER_KB(r->flags) * 1024;
+                        if (!_growBuffer(p, p->length + HTTPS_BUFFER_KB(r->flags) * 1024)) return 0;
                     }
                 }
             }
@@ -303,80 +1109,188 @@ void httpsInit(httpsInitData init, unsigned int readBufferSize) {
     con.bufferSize = readBufferSize;
     if (con.bufferSize == 0) con.bufferSize = 16384;
     pthread_mutex_init(&con.mainLock, NULL);
+    pthread_mutex_init(&con.chunkLock, NULL);
+    pthread_mutex_init(&con.poolLock, NULL);
+    pthread_mutex_init(&con.sizeLock, NULL);
+    pthread_mutex_init(&con.scheduleLock, NULL);
+    con.activeLimit = _activeLimit;
+    con.hostLimit = _hostLimit;
+    _ENTER_
+    _growRequests(_requestReserve);
+    __EXIT_
+}
+
+/*
+    Make sure at least count request slots exist, growing the table now rather than on demand.
+
+    Called before httpsInit() this sets the size the table starts with (MAX_REQUEST by default).
+*/
+void httpsReserveRequests(unsigned int count) {
+    if (con.bufferSize == 0) {
+        _requestReserve = count;
+        return;
+    }
+    _ENTER_
+    _growRequests(count);
+    __EXIT_
 }
 
 void httpsCleanup() {
     _ENTER_
-    for (int i = 0; i < MAX_REQUEST; i++)
+    for (int i = 0; i < con.requestCapacity; i++)
     {
-        httpsReq* r = con.requestTable[i];
+        httpsReq* r = _liveReq(i);
         if (r != NULL) {
             if (r->complete && r->finished) {
                 // delete it
                 _delHttpsReq(r);
             } else {
                 // force it to end
-                naettClose((naettRes*)r->res);
-                naettFree((naettReq*)r->request);
-                con.requestTable[i] = NULL;
+                if (r->res != NULL) naettClose((naettRes*)r->res);
+                if (r->request != NULL) naettFree((naettReq*)r->request);
+                if (r->prepared != NULL) _preparedDrop(r->prepared);
+                r->prepared = NULL;
+                r->live = false;
             }    
         }
     }
+    xatomic_store(&con.eventHead, NULL);
+    con.touchedCount = 0;
     __EXIT_
+    // nothing runs or waits anymore
+    pthread_mutex_lock(&con.scheduleLock);
+    for (int c = 0; c < SCHEDULE_CLASSES; c++) {
+        mem.free(con.queue[c]);
+        con.queue[c] = NULL;
+        con.queueCount[c] = con.queueCapacity[c] = 0;
+    }
+    con.activeCount = 0;
+    memset(con.hostActive, 0, sizeof(con.hostActive));
+    pthread_mutex_unlock(&con.scheduleLock);
+    // and the idle chunks
+    pthread_mutex_lock(&con.chunkLock);
+    while (con.chunkFree != NULL) {
+        httpsChunk *c = con.chunkFree;
+        con.chunkFree = c->next;
+        mem.free(c);
+    }
+    con.chunkFreeCount = 0;
+    pthread_mutex_unlock(&con.chunkLock);
+    // and the pooled buffers, the depot and every thread's cache (every transfer is closed by now,
+    // so no thread is using its cache; the epoch tells them to make a new one next time)
+    pthread_mutex_lock(&con.poolLock);
+    while (con.poolCaches != NULL) {
+        poolCache *t = con.poolCaches;
+        con.poolCaches = t->next;
+        for (int c = 0; c < POOL_CLASSES; c++) {
+            while (t->head[c] != NULL) {
+                poolBuffer *b = t->head[c];
+                t->head[c] = b->next;
+                mem.free(b);
+            }
+        }
+        mem.free(t);
+    }
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        while (con.poolDepot[c] != NULL) {
+            poolBuffer *b = con.poolDepot[c];
+            con.poolDepot[c] = b->next;
+            mem.free(b);
+        }
+        con.poolDepotCount[c] = 0;
+    }
+    xatomic_add(&_poolEpoch, 1);
+    pthread_mutex_unlock(&con.poolLock);
 }
 
 void httpsUpdate() {
+    httpsReq *list, *r, *next, *ordered = NULL;
+    bool freed = false;
     if (con.bufferSize == 0) return;
+    // nothing happened since last time? then there is nothing to do
+    list = xatomic_exchange(&con.eventHead, NULL);
+    if (list == NULL) {
+        con.touchedCount = 0;
+        return;
+    }
+    // the list comes off newest first, flip it so events are handled in arrival order
+    while (list != NULL) {
+        next = list->nextEvent;
+        list->nextEvent = ordered;
+        ordered = list;
+        list = next;
+    }
     _ENTER_
-    for (int i = 0; i < MAX_REQUEST; i++)
+    con.touchedCount = 0;
+    for (r = ordered; r != NULL; r = next)
     {
-        httpsReq* r = con.requestTable[i];
-        if (r != NULL) {
-            // if we are done totally, free the request so it can be deleted,
-            // opening the slot it's taking
-            if (r->complete && r->finished) {
-                // delete it
+        // read the link before clearing the bits, after that the transport may queue it again
+        next = r->nextEvent;
+        unsigned int events = xatomic_exchange(&r->events, 0);
+        if (!r->live) continue;
+        // if we are done totally, free the request so it can be deleted,
+        // opening the slot it's taking
+        if (r->complete && r->finished) {
+            // delete it
+            _delHttpsReq(r);
+            continue;
+        }
+        if (r->res == NULL) {
+            // still waiting for room? then a release means it never goes out at all
+            if (_unqueue(r)) {
+                r->complete = true;
                 _delHttpsReq(r);
-            } else {
-                // update status on the response
-                int rc, comp;
-                rc = naettGetStatus(r->res);
-                if (rc != r->returnCode) {
-                    r->returnCode = rc;
-                }
-                if (r->headerDone) {
-                    // might be valid, probe httpsHeaders for content type and length
-                    char *hval = (char*)naettGetHeader((naettRes*)r->res, "Content-Length");
-                    if (hval != NULL) r->contentTotalBytes = atoi(hval);
-                    r->contentMimeType = (char*)naettGetHeader((naettRes*)r->res, "Content-Type");
-                }
-                comp = naettComplete((naettRes*)r->res);
-                if (comp != r->complete) {
-                    r->complete = comp;    
-                }    
+                continue;
             }
-            
+            // the transport beat httpsGet() to storing the response, look again next time
+            _postEvent(r, events);
+            continue;
         }
+        // update status on the response
+        r->returnCode = naettGetStatus(r->res);
+        if ((events & REQ_EVENT_HEADERS) || (!r->headerDone && (events & REQ_EVENT_READ))) {
+            // content type and length were parsed as the headers arrived, once per header block
+            const naettHeaderInfo *info = naettGetHeaderInfo((naettRes*)r->res);
+            if (info->contentLength >= 0) r->contentTotalBytes = (unsigned int)info->contentLength;
+            if (info->contentType != NULL) r->contentMimeType = (char*)info->contentType;
+            r->headerDone = true;
+        }
+        if ((events & REQ_EVENT_COMPLETE) && !r->complete) {
+            r->complete = true;
+            _finishRun(r);
+            freed = true;
+            // learn from every body that could have grown (not from heads or failures)
+            if ((r->endpoint != 0) && (r->readTotalBytes > 0) && (r->returnCode >= 200) && (r->returnCode < 300)) _sizeSample(r);
+        }
+        // released before it completed, so it goes on the next pass
+        if (r->complete && r->finished) _postEvent(r, REQ_EVENT_FINISHED);
+        // remember it for easyUpdate
+        if (con.touchedCount == con.touchedCapacity) {
+            int capacity = con.touchedCapacity ? con.touchedCapacity * 2 : MAX_REQUEST;
+            int *grown = mem.realloc(con.touched, sizeof(int) * capacity);
+            if (grown == NULL) continue;
+            con.touched = grown;
+            con.touchedCapacity = capacity;
+        }
+        con.touched[con.touchedCount++] = r->index;
     }
     __EXIT_
+    // finished transfers made room for waiting ones
+    if (freed) _promote();
 }
 
 unsigned int httpsRequestCount() {
-    unsigned int ret = 0;
-    _ENTER_
-    for (int i = 0; i < MAX_REQUEST; i++)
-        if (con.requestTable[i] != NULL) ret++;
-    __EXIT_
-    return ret;
+    return xatomic_load(&con.requestCount);
 }
 
 void* _makeRequest(httpsReq* r, const char *method, void* _httpsHeaders, unsigned int bodyBytes, const char* body) {
     if (_httpsHeaders == NULL) {
-        return (void*)naettRequest(r->URL, naettMethod(method), naettHeader("accept", "*/*"), naettBodyWriter(_bodyWriter, r));
+        return (void*)naettRequest(r->URL, naettMethod(method), naettHeader("accept", "*/*"), naettBodyWriter(_bodyWriter, r),
+            naettEventHandler(_eventHandler, r));
     } else {
         httpsHeaders *h = (httpsHeaders*)_httpsHeaders;
         naettOption* bopt = NULL;
-        int l = h->count + 2;
+        int l = 5;
         int x = 0;
         if (body != NULL)
         {
@@ -384,12 +1298,14 @@ void* _makeRequest(httpsReq* r, const char *method, void* _httpsHeaders, unsigne
             if (bodyBytes == 0) bodyBytes = strlen(body);
             bopt = naettBody(body, bodyBytes);
         }
-        naettOption** opts = calloc(1,sizeof(naettOption*)*l);
+        naettOption** opts = _arenaAlloc(r, sizeof(naettOption*)*l);
         opts[x++] = naettMethod(method);
         opts[x++] = naettHeader("accept", "*/*");
+        opts[x++] = naettBodyWriter(_bodyWriter, r);
+        opts[x++] = naettEventHandler(_eventHandler, r);
         if (bopt != NULL) opts[x++] = bopt;
-        for (int i = 0; i < h->count; i++)
-            opts[x++] = naettHeader(h->str[i*2], h->str[i*2+1]);
+        // the packed block goes over as is, one copy into the request
+        opts[x++] = naettHeaderBlock(h->count, h->pool, h->offset);
         return (void*)naettRequestWithOptions(r->URL, l, (const naettOption**)opts);
     }
 }
@@ -397,11 +1313,23 @@ void* _makeRequest(httpsReq* r, const char *method, void* _httpsHeaders, unsigne
 void* httpsGet(const char *URL, int flags,  void *httpsHeaders) {
     httpsReq* r;
     if ((con.bufferSize == 0) || (URL == NULL) || (strlen(URL) == 0)) return NULL;
-    r = _newHttpsReq(flags);
+    r = _newHttpsReq(URL, flags);
     if (r == NULL) return NULL;
-    r->URL = memStrdup(URL);
     r->request = _makeRequest(r, "GET", httpsHeaders, 0, NULL);
-    r->res = (void*)naettMake((naettReq*)r->request);
+    _admit(r);
+    r->complete = r->finished = false;
+    return (void*)r;
+}
+
+void* httpsGetStreamed(const char *URL, int flags, void *httpsHeaders, httpsSink sink, void *user) {
+    httpsReq* r;
+    if ((con.bufferSize == 0) || (URL == NULL) || (strlen(URL) == 0) || (sink == NULL)) return NULL;
+    r = _newHttpsReq(URL, flags | HTTPS_STREAM);
+    if (r == NULL) return NULL;
+    r->sink = sink;
+    r->sinkUser = user;
+    r->request = _makeRequest(r, "GET", httpsHeaders, 0, NULL);
+    _admit(r);
     r->complete = r->finished = false;
     return (void*)r;
 }
@@ -409,21 +1337,19 @@ void* httpsGet(const char *URL, int flags,  void *httpsHeaders) {
 void* httpsPost(const char *URL, int flags,  const char *body, unsigned int bodyBytes, void *httpsHeaders) {
     httpsReq* r;
     if ((con.bufferSize == 0) || (URL == NULL) || (strlen(URL) == 0)) return NULL;
-    r = _newHttpsReq(flags);
+    r = _newHttpsReq(URL, flags);
     if (r == NULL) return NULL;
-    r->URL = memStrdup(URL);
     if (bodyBytes == 0) {
         if ((body == NULL) || (strlen(body) == 0)) return NULL;
-        r->body = memStrdup(body);
         r->bodyTotalBytes = strlen(body);
+        r->body = _arenaStrdup(r, body, r->bodyTotalBytes);
     } else
     {
         r->bodyTotalBytes = bodyBytes;
-        r->body = malloc(bodyBytes);
-        memcpy(r->body, body, bodyBytes);
+        r->body = _arenaStrdup(r, body, bodyBytes);
     }
     r->request = _makeRequest(r, "POST", httpsHeaders, bodyBytes, body);
-    r->res = (void*)naettMake((naettReq*)r->request);
+    _admit(r);
     r->complete = r->finished = false;
     return (void*)r;
 }
@@ -431,9 +1357,8 @@ void* httpsPost(const char *URL, int flags,  const char *body, unsigned int body
 void* httpsPostLinked(const char *URL, int flags,  const char *body, unsigned int bodyBytes, void *httpsHeaders) {
     httpsReq* r;
     if ((con.bufferSize == 0) || (URL == NULL) || (strlen(URL) == 0)) return NULL;
-    r = _newHttpsReq(flags);
+    r = _newHttpsReq(URL, flags);
     if (r == NULL) return NULL;
-    r->URL = memStrdup(URL);
     if (bodyBytes == 0) {
         if ((body == NULL) || (strlen(body) == 0)) return NULL;
         r->body = (char*)body;
@@ -444,7 +1369,7 @@ void* httpsPostLinked(const char *URL, int flags,  const char *body, unsigned in
         r->body = (char*)body;
     }
     r->request = _makeRequest(r, "POST", httpsHeaders, bodyBytes, body);
-    r->res = (void*)naettMake((naettReq*)r->request);
+    _admit(r);
     r->complete = r->finished = false;
     return (void*)r;
 }
@@ -452,15 +1377,165 @@ void* httpsPostLinked(const char *URL, int flags,  const char *body, unsigned in
 void* httpsHead(const char *URL, int flags,  void *httpsHeaders) {
     httpsReq* r;
     if ((con.bufferSize == 0) || (URL == NULL) || (strlen(URL) == 0)) return NULL;
-    r = _newHttpsReq(flags);
+    r = _newHttpsReq(URL, flags);
     if (r == NULL) return NULL;
-    r->URL = memStrdup(URL);
     r->request = _makeRequest(r, "HEAD", httpsHeaders, 0, NULL);
-    r->res = (void*)naettMake((naettReq*)r->request);
+    _admit(r);
     r->complete = r->finished = false;
     return (void*)r;    
 }
 
+// http:// or https:// and then a host
+static bool _validURL(const char *URL) {
+    const char *host;
+    if (!strncasecmp(URL, "https://", 8)) host = URL + 8;
+    else if (!strncasecmp(URL, "http://", 7)) host = URL + 7;
+    else return false;
+    return (*host != 0) && (*host != '/') && (*host != ':') && (*host != '?') && (*host != '#');
+}
+
+void* httpsPrepare(const char *URL, const char *method, void *headers, const char *body, unsigned int bodyBytes) {
+    httpsHeaders *h = (httpsHeaders*)headers;
+    naettOption* opts[3];
+    int l = 0;
+    if ((con.bufferSize == 0) || (URL == NULL) || !_validURL(URL)) return NULL;
+    if (method == NULL) method = "GET";
+    if ((body != NULL) && (bodyBytes == 0)) bodyBytes = strlen(body);
+    // the url and the body live in the same block as the template
+    unsigned int URLBytes = strlen(URL);
+    httpsPrepared *t = mem.malloc(sizeof(httpsPrepared) + URLBytes + 1 + bodyBytes);
+    if (t == NULL) return NULL;
+    t->URL = (char*)(t + 1);
+    memcpy(t->URL, URL, URLBytes + 1);
+    t->URLBytes = URLBytes;
+    t->body = (bodyBytes > 0) ? t->URL + URLBytes + 1 : NULL;
+    if (t->body != NULL) memcpy(t->body, body, bodyBytes);
+    t->bodyBytes = bodyBytes;
+    t->endpoint = _endpointKey(URL, NULL, 0);
+    t->refs = 1;
+    // everything but the writer and event handler, those belong to each fired request
+    opts[l++] = naettMethod(method);
+    opts[l++] = naettHeader("accept", "*/*");
+    if ((h != NULL) && (h->count > 0)) opts[l++] = naettHeaderBlock(h->count, h->pool, h->offset);
+    t->request = naettRequestWithOptions(t->URL, l, (const naettOption**)opts);
+    if (t->request == NULL) {
+        mem.free(t);
+        return NULL;
+    }
+    return (void*)t;
+}
+
+// a request from a template, sink set means streamed (and only then)
+static httpsReq* _fire(httpsPrepared *t, int flags, const char *query, const char *body, unsigned int bodyBytes, httpsSink sink, void *user) {
+    char local[512];
+    char *URL;
+    httpsReq *r;
+    naettOption* opts[3];
+    int l = 0;
+    if ((con.bufferSize == 0) || (t == NULL)) return NULL;
+    URL = t->URL;
+    if ((query != NULL) && (*query != 0)) {
+        // the query goes after whatever the prepared url already has
+        size_t q = strlen(query);
+        if (t->URLBytes + q + 2 > sizeof(local)) URL = mem.malloc(t->URLBytes + q + 2);
+            else URL = local;
+        if (URL == NULL) return NULL;
+        memcpy(URL, t->URL, t->URLBytes);
+        URL[t->URLBytes] = (strchr(t->URL, '?') != NULL) ? '&' : '?';
+        memcpy(URL + t->URLBytes + 1, query, q + 1);
+    }
+    flags = (sink != NULL) ? (flags | HTTPS_STREAM) : (flags & ~HTTPS_STREAM);
+    r = _newHttpsReqKeyed(URL, flags, t->endpoint);
+    if ((URL != t->URL) && (URL != local)) mem.free(URL);
+    if (r == NULL) return NULL;
+    xatomic_add(&t->refs, 1);
+    r->prepared = t;
+    r->sink = sink;
+    r->sinkUser = user;
+    opts[l++] = naettBodyWriter(_bodyWriter, r);
+    opts[l++] = naettEventHandler(_eventHandler, r);
+    if (body != NULL) {
+        // copied like httpsPost() does, the prepared body is already ours
+        if (bodyBytes == 0) bodyBytes = strlen(body);
+        body = _arenaStrdup(r, body, bodyBytes);
+    } else {
+        body = t->body;
+        bodyBytes = t->bodyBytes;
+    }
+    if ((body != NULL) && (bodyBytes > 0)) {
+        r->body = (char*)body;
+        r->bodyTotalBytes = bodyBytes;
+        opts[l++] = naettBody(body, bodyBytes);
+    }
+    r->request = (void*)naettRequestFrom(t->request, (URL != t->URL) ? r->URL : NULL, l, (const naettOption**)opts);
+    if (r->request == NULL) {
+        _ENTER_
+        _delHttpsReq(r);
+        __EXIT_
+        return NULL;
+    }
+    _admit(r);
+    r->complete = r->finished = false;
+    return r;
+}
+
+void* httpsFire(void *prepared, int flags, const char *query, const char *body, unsigned int bodyBytes) {
+    return (void*)_fire((httpsPrepared*)prepared, flags, query, body, bodyBytes, NULL, NULL);
+}
+
+void httpsUnprepare(void *prepared) {
+    if (prepared != NULL) _preparedDrop((httpsPrepared*)prepared);
+}
+
+int httpsSubmitBatch(const char *method, const char **URLs, int count, int flags, void *headers, void **out) {
+    httpsPrepared *t = NULL;
+    naettOption* opts[2];
+    int i, n = 0;
+    if ((con.bufferSize == 0) || (URLs == NULL) || (out == NULL) || (count <= 0)) return 0;
+    // nothing to sink into, and the request table grows once for the lot if it has to
+    flags &= ~HTTPS_STREAM;
+    if (xatomic_load(&con.requestCount) + count > xatomic_load(&con.requestCapacity)) {
+        _ENTER_
+        _growRequests(con.requestCount + count);
+        __EXIT_
+    }
+    // one base request carries the method and headers (and on linux the header list) for every url
+    for (i = 0; (i < count) && (t == NULL); i++)
+        if ((URLs[i] != NULL) && _validURL(URLs[i])) t = httpsPrepare(URLs[i], method, headers, NULL, 0);
+    httpsReq **reqs = (t != NULL) ? mem.malloc(sizeof(httpsReq*) * count) : NULL;
+    if (reqs == NULL) {
+        httpsUnprepare(t);
+        for (i = 0; i < count; i++) out[i] = NULL;
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        httpsReq *r = NULL;
+        if ((URLs[i] != NULL) && _validURL(URLs[i])) r = _newHttpsReq(URLs[i], flags);
+        out[i] = (void*)r;
+        if (r == NULL) continue;
+        xatomic_add(&t->refs, 1);
+        r->prepared = t;
+        opts[0] = naettBodyWriter(_bodyWriter, r);
+        opts[1] = naettEventHandler(_eventHandler, r);
+        r->request = (void*)naettRequestFrom(t->request, r->URL, 2, (const naettOption**)opts);
+        if (r->request == NULL) {
+            // never reaches the transport, the slot and its template ref go straight back
+            _ENTER_
+            _delHttpsReq(r);
+            __EXIT_
+            out[i] = NULL;
+            continue;
+        }
+        r->complete = r->finished = false;
+        reqs[n++] = r;
+    }
+    // and over to the transport in one go, the ones there is room for
+    _admitMany(reqs, n);
+    mem.free(reqs);
+    httpsUnprepare(t);
+    return n;
+}
+
 int httpsGetCode(void *p) {
     httpsReq *r = (httpsReq*)p;
     int ret;
@@ -472,9 +1547,8 @@ int httpsGetCode(void *p) {
 
 int httpsGetCodeI(int i) {
     int ret;
-    _ENTER_
-    httpsReq *r = con.requestTable[i];
-    __EXIT_
+    httpsReq *r = _liveReq(i);
+    if (r == NULL) return naettGenericError;
     _ENTER_REQ(r)
     ret = naettGetStatus((naettRes*)r);
     _EXIT_REQ(r)
@@ -517,31 +1591,74 @@ void httpsFinished(void *p) {
     _ENTER_REQ(r)
     r->finished = true;
     _EXIT_REQ(r)
+    _postEvent(r, REQ_EVENT_FINISHED);
+}
+
+// the offset table and pool start right after the struct
+static inline bool _headersInline(httpsHeaders *h) {
+    return h->offset == (unsigned int*)(h + 1);
 }
 
 void* httpsNewhttpsHeaders() {
-    httpsHeaders *h = calloc(1,sizeof(httpsHeaders));
+    httpsHeaders *h = mem.malloc(sizeof(httpsHeaders) + sizeof(unsigned int) * HTTPS_HEADER_PAIRS * 2 + HTTPS_HEADER_POOL);
+    if (h == NULL) return NULL;
+    h->count = 0;
+    h->capacity = HTTPS_HEADER_PAIRS;
+    h->used = 0;
+    h->size = HTTPS_HEADER_POOL;
+    h->offset = (unsigned int*)(h + 1);
+    h->pool = (char*)(h->offset + HTTPS_HEADER_PAIRS * 2);
     return (void*)h;
 }
 
-void httpsSetHeader(httpsHeaders *h, const char *name, const char *val) {
+// make room for one more pair and bytes more pool, moving both into a bigger block of their own
+static bool _headersReserve(httpsHeaders *h, unsigned int bytes) {
+    int capacity = h->capacity;
+    unsigned int size = h->size;
+    if ((h->count < capacity) && (h->used + bytes <= size)) return true;
+    if (h->count == capacity) capacity *= 2;
+    while (h->used + bytes > size) size *= 2;
+    unsigned int *offset = mem.malloc(sizeof(unsigned int) * capacity * 2 + size);
+    if (offset == NULL) return false;
+    char *pool = (char*)(offset + capacity * 2);
+    memcpy(offset, h->offset, sizeof(unsigned int) * h->count * 2);
+    memcpy(pool, h->pool, h->used);
+    if (!_headersInline(h)) mem.free(h->offset);
+    h->offset = offset;
+    h->pool = pool;
+    h->capacity = capacity;
+    h->size = size;
+    return true;
+}
+
+static unsigned int _headersAdd(httpsHeaders *h, const char *str, unsigned int bytes) {
+    unsigned int at = h->used;
+    memcpy(h->pool + at, str, bytes);
+    h->pool[at + bytes] = 0;
+    h->used += bytes + 1;
+    return at;
+}
+
+// set a header from counted strings, a name already there (any case) just gets the new value
+static void _setHeader(httpsHeaders *h, const char *name, unsigned int nameBytes, const char *val, unsigned int valBytes) {
     int i;
-    for (i = 0; i < MAX_HEADERS; i++) {
-        if (!strcmp(name,h->str[i*2])) {
-            mem.free(h->str[i*2+1]);
-            h->str[i*2+1] = memStrdup(val);
-        }
-    }
-    if ((i == MAX_HEADERS) && (h->count != MAX_HEADERS)) {
-        i = h->count++;
-        h->str[i*2] = memStrdup(name);
-        h->str[i*2+1] = memStrdup(val);
+    for (i = 0; i < h->count; i++) {
+        const char *n = HTTPS_HEADER_NAME(h, i);
+        if (!strncasecmp(n, name, nameBytes) && (n[nameBytes] == 0)) break;
     }
+    if ((i == h->count) && (h->count == MAX_HEADERS)) return;
+    if (!_headersReserve(h, nameBytes + valBytes + 2)) return;
+    if (i == h->count) h->offset[h->count++ * 2] = _headersAdd(h, name, nameBytes);
+    // a replaced value just leaves its old bytes behind in the pool
+    h->offset[i*2+1] = _headersAdd(h, val, valBytes);
+}
+
+void httpsSetHeader(httpsHeaders *h, const char *name, const char *val) {
+    _setHeader(h, name, strlen(name), val, strlen(val));
 }
 
 void httpsDelhttpsHeaders(httpsHeaders *h) {
-    for (int i = 0; i < h->count*2; i++)
-        mem.free(h->str[i]);
+    if (!_headersInline(h)) mem.free(h->offset);
     mem.free((httpsHeaders*)h);
 }
 
@@ -570,26 +1687,88 @@ void httpsGetBodyBuffer(void *p, memBuffer *b) {
     _EXIT_REQ(r)
 }
 
+/*
+    Point iov at the pieces of a chunked body, in order, and return how many pieces there are
+    (which can be more than max). Safe while the body is still arriving, the pieces stay put
+    until the request is deleted or flattened.
+*/
+int httpsGetBodyChunks(void *p, httpsIovec *iov, int max) {
+    httpsReq *r = (httpsReq*)p;
+    int i = 0;
+    _ENTER_REQ(r)
+    for (httpsChunk *c = r->chunkHead; (c != NULL) && (i < max); c = c->next, i++) {
+        iov[i].base = c->data;
+        iov[i].len = c->end;
+    }
+    i = r->chunkCount;
+    _EXIT_REQ(r)
+    return i;
+}
+
+/*
+    Turn a complete chunked body into an ordinary contiguous one, for the callers that need that.
+    Returns true when the body is contiguous (it already was, or now is).
+*/
+bool httpsFlattenBody(void *p) {
+    httpsReq *r = (httpsReq*)p;
+    httpsChunk *c;
+    unsigned char *data;
+    unsigned int end = 0;
+    if (!(r->flags & HTTPS_CHUNK_BUFFER)) return true;
+    if (!httpsIsComplete(r)) return false;
+    data = mem.malloc(r->readTotalBytes + 1);
+    if (data == NULL) return false;
+    _ENTER_REQ(r)
+    for (c = r->chunkHead; c != NULL; c = c->next) {
+        memcpy(data + end, c->data, c->end);
+        end += c->end;
+    }
+    c = r->chunkHead;
+    r->chunkHead = r->chunkTail = NULL;
+    r->chunkCount = 0;
+    r->buffer.data = data;
+    r->buffer.end = end;
+    r->buffer.length = r->readTotalBytes + 1;
+    r->flags &= ~HTTPS_CHUNK_BUFFER;
+    _EXIT_REQ(r)
+    xatomic_add(&con.bufferBytes, r->buffer.length);
+    _giveChunks(c);
+    return true;
+}
+
 void httpsRelease(void *p) {
     httpsReq *r = (httpsReq*)p;
     _ENTER_REQ(r)
     r->finished = true;
     _EXIT_REQ(r)
+    _postEvent(r, REQ_EVENT_FINISHED);
 }
 
 void httpsGetInfo(httpsSystemInfo *info) {
     memset(info, 0, sizeof(httpsSystemInfo));
     _ENTER_
-    for (int i = 0; i < MAX_REQUEST; i++) {
-        httpsReq *r = con.requestTable[i];
+    for (int i = 0; i < con.requestCapacity; i++) {
+        httpsReq *r = _liveReq(i);
         if (r != NULL) {
             info->numRequests++;
             if (!r->complete) info->activeRequests++;
         }
     }
-    info->maxRequests = MAX_REQUEST;
+    info->maxRequests = MAX_REQUEST_LIMIT;
     info->bufferBytes = con.bufferBytes;
     __EXIT_
+    pthread_mutex_lock(&con.scheduleLock);
+    info->runningRequests = con.activeCount;
+    for (int c = 0; c < SCHEDULE_CLASSES; c++) info->queuedRequests += con.queueCount[c];
+    pthread_mutex_unlock(&con.scheduleLock);
+    naettStats stats;
+    naettGetStats(&stats);
+    info->transfers = stats.transfers;
+    info->newConnections = stats.connections;
+    info->handshakeSeconds = (double)stats.handshakeMicroseconds * 0.000001;
+    info->resumedSessions = stats.resumedSessions;
+    info->poolHits = xatomic_load(&con.poolHits);
+    info->poolMisses = xatomic_load(&con.poolMisses);
 }
 
 bool libhttpsLove = false;
@@ -622,14 +1801,17 @@ void _stringSep(char* str, char** k, char** v)
 
 httpsHeaders *_easyCreateHeaders(const char* *_httpsHeaders, int header_count, bool compact)
 {
-    httpsHeaders *h = calloc(1,sizeof(_httpsHeaders));
+    httpsHeaders *h = httpsNewhttpsHeaders();
+    if (h == NULL) return NULL;
     if (compact) {
+        // "name: value", split in place
         for (int i = 0; i < header_count; i++)
         {
-            char *k, *v;
-            char *tst = memStrdup(_httpsHeaders[i]);
-            _stringSep(tst, &k, &v);
-            httpsSetHeader(h, k, v);
+            const char *v = strchr(_httpsHeaders[i], ':');
+            if (v == NULL) continue;
+            unsigned int k = v - _httpsHeaders[i];
+            for (v++; isspace((unsigned char)*v); v++);
+            _setHeader(h, _httpsHeaders[i], k, v, strlen(v));
         }
     } else {
         for (int i = 0; i < header_count; i++)
@@ -640,10 +1822,13 @@ httpsHeaders *_easyCreateHeaders(const char* *_httpsHeaders, int header_count, b
     return h;
 }
 
+static httpsReq* _easyReq(int h);
+
 const char* _easyGetHeader(int i, const char *header)
 {
-    httpsReq* r = con.requestTable[i];
+    httpsReq* r = _easyReq(i);
     const char *ret;
+    if (r == NULL) return NULL;
     _ENTER_REQ(r)
     ret = naettGetHeader((naettRes*)r->res, header);
     _EXIT_REQ(r)
@@ -651,8 +1836,22 @@ const char* _easyGetHeader(int i, const char *header)
 }
 
 easyCallback _theEasyCallback = NULL;
+easyEventCallback _theEventCallback = NULL;
+bool _eventBatched = false;
+// events held for the end of easyUpdate() when batched
+easyEvent *_eventBatch = NULL;
+unsigned int *_eventGens = NULL;    // the slot generation each held event was made under
+int _eventCount = 0;
+int _eventCapacity = 0;
+int _eventCallouts = 0;             // user callbacks running right now, see easyCalloutEnd()
+
+// what the easyCallback is told, by EASY_EVENT_*
+static const char *_easyEventNames[EASY_EVENT_COUNT] = {
+    "", "START", "UPDATE", "httpsHeaders", "LENGTH", "MIME", "READ", "COMPLETE", "CHUNK"
+};
 
 typedef struct _easyData {
+    int handle;         // the handle callbacks report, the slot in threaded mode
     bool complete;
     bool headerDone;
     int returnCode;
@@ -661,8 +1860,64 @@ typedef struct _easyData {
     char *contentMimeType;
     void *user;
     int flushMode;
+    memBuffer chunk;    // streamed bytes the callback hasn't seen yet, guarded by the request mutex
+    unsigned int events;        // EASY_EVENT_MASK()s the callback wants, 0 everything
+    unsigned int progressBytes; // least bytes between READs
+    double progressSeconds;     // least time between READs
+    double progressTime;        // when the last READ went
 } easyData;
 
+static inline bool easyWants(easyData *d, int event) {
+    return (d->events == 0) || (d->events & EASY_EVENT_MASK(event));
+}
+
+static inline easyData* easyNewData(int handle) {
+    easyData *d = mem.calloc(1, sizeof(easyData));
+    d->handle = handle;
+    return d;
+}
+
+// streamed requests: the callback can't run on the transport thread, so each chunk is staged here
+// until the next update hands it over (the body as a whole is never buffered)
+static int easyChunkSink(void *p, const char *data, unsigned int bytes, void *user) {
+    httpsReq *r = (httpsReq*)p;
+    easyData *d;
+    int written = 0;
+    _ENTER_REQ(r)
+    // cleared when the handle is released, so a transfer nobody wants any more gets aborted
+    d = (easyData*)r->sinkUser;
+    if (d != NULL) {
+        memBuffer *c = &d->chunk;
+        if (c->end + bytes > c->length) {
+            unsigned int length = c->length ? c->length * 2 : con.bufferSize;
+            while (length < c->end + bytes) length *= 2;
+            unsigned char *grown = mem.realloc(c->data, length);
+            if (grown != NULL) {
+                c->data = grown;
+                c->length = length;
+            }
+        }
+        if (c->end + bytes <= c->length) {
+            memcpy(c->data + c->end, data, bytes);
+            c->end += bytes;
+            written = bytes;
+        }
+    }
+    _EXIT_REQ(r)
+    return written;
+}
+
+// take whatever has been staged, the caller owns (and frees) what comes back
+static char* easyTakeChunk(httpsReq *r, easyData *d, unsigned int *bytes) {
+    char *data;
+    _ENTER_REQ(r)
+    data = (char*)d->chunk.data;
+    *bytes = d->chunk.end;
+    memset(&d->chunk, 0, sizeof(memBuffer));
+    _EXIT_REQ(r)
+    return data;
+}
+
 typedef struct _easyMetric {
     int handle;
     const char *url;
@@ -674,40 +1929,167 @@ typedef struct _easyMetric {
     double estimatedRemainingTime;
 } easyMetric;
 
+// a bounded lock-free queue (Vyukov's): every cell carries a sequence number that says whether it is
+// ready to be written or read at a given position, so producers and consumers only ever race on
+// their own counter; head and tail sit on separate cache lines so the two sides don't share one
+#define EASY_CACHE_LINE     64
+
+typedef struct _easyRing {
+    char pad0[EASY_CACHE_LINE];
+    unsigned long head;             // next position to read
+    char pad1[EASY_CACHE_LINE - sizeof(unsigned long)];
+    unsigned long tail;             // next position to write
+    char pad2[EASY_CACHE_LINE - sizeof(unsigned long)];
+    unsigned long mask;             // capacity - 1, capacity is a power of two
+    size_t itemSize;
+    size_t cellSize;
+    char *cells;                    // each cell is an unsigned long sequence followed by the item
+} easyRing;
+
+#define RING_CELL(q, pos)   ((q)->cells + ((pos) & (q)->mask) * (q)->cellSize)
+#define RING_SEQ(c)         ((unsigned long*)(c))
+#define RING_ITEM(c)        ((c) + sizeof(unsigned long))
+
+static easyRing* easyRingNew(unsigned int capacity, size_t itemSize) {
+    easyRing *q = mem.calloc(1, sizeof(easyRing));
+    unsigned long n = 2;
+    if (q == NULL) return NULL;
+    while (n < capacity) n <<= 1;
+    q->mask = n - 1;
+    q->itemSize = itemSize;
+    // keep every sequence number aligned
+    q->cellSize = (sizeof(unsigned long) + itemSize + sizeof(unsigned long) - 1) & ~(sizeof(unsigned long) - 1);
+    q->cells = mem.calloc(n, q->cellSize);
+    if (q->cells == NULL) {
+        mem.free(q);
+        return NULL;
+    }
+    for (unsigned long i = 0; i < n; i++) *RING_SEQ(RING_CELL(q, i)) = i;
+    return q;
+}
+
+// false when full, nothing is written
+static bool easyRingPush(easyRing *q, const void *item) {
+    unsigned long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    char *cell;
+    while (1) {
+        cell = RING_CELL(q, pos);
+        long diff = (long)(xatomic_load(RING_SEQ(cell)) - pos);
+        if (diff == 0) {
+            if (xatomic_cas(&q->tail, &pos, pos + 1)) break;
+        } else if (diff < 0) {
+            return false;
+        } else pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+    memcpy(RING_ITEM(cell), item, q->itemSize);
+    xatomic_store(RING_SEQ(cell), pos + 1);
+    return true;
+}
+
+// false when empty
+static bool easyRingPop(easyRing *q, void *item) {
+    unsigned long pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    char *cell;
+    while (1) {
+        cell = RING_CELL(q, pos);
+        long diff = (long)(xatomic_load(RING_SEQ(cell)) - (pos + 1));
+        if (diff == 0) {
+            if (xatomic_cas(&q->head, &pos, pos + 1)) break;
+        } else if (diff < 0) {
+            return false;
+        } else pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+    memcpy(item, RING_ITEM(cell), q->itemSize);
+    xatomic_store(RING_SEQ(cell), pos + q->mask + 1);
+    return true;
+}
+
+static bool easyRingEmpty(easyRing *q) {
+    unsigned long pos = xatomic_load(&q->head);
+    return (long)(xatomic_load(RING_SEQ(RING_CELL(q, pos))) - (pos + 1)) < 0;
+}
+
+static void easyRingFree(easyRing *q) {
+    if (q == NULL) return;
+    mem.free(q->cells);
+    mem.free(q);
+}
+
 typedef struct _easyThreadStack {
     int version;
     int msgLimit;
-    int slotLimit;
-    easyMessage *msg;
+    int slotLimit;              // slots handed out to the free ring so far, only the main thread grows it
+    int slotCapacity;           // slots reserved, slotLimit grows toward this
+    // results for the main thread (easyMessage), when full the worker waits for a drain
+    easyRing *msg;
+    // commands, one per threaded handle, filled in by whoever claimed the slot
     easyMessage *slot;
-    pthread_mutex_t msgLock;
-    pthread_mutex_t slotLock;
+    easyRing *freeSlots;        // slot numbers ready to be claimed
+    easyRing *commands;         // slot numbers to start, or'd with EASY_CMD_RELEASE to hand back (EASY_CMD_BATCH to start a batch)
+    bool *slotRelease;          // a release has been queued for this slot
+    int *deferred;              // releases made during a callout, queued once it returns
+    int deferredCount;
+    unsigned int *slotGen;      // bumped on claim and release, stale messages are dropped
+    // worker side
+    httpsReq **slotReq;         // the request each slot is running
+    bool quit;
+    // only for sleeping, producers touch it when the worker says it is asleep
+    int sleeping;
+    pthread_cond_t wake;
+    pthread_mutex_t wakeLock;
 } easyThreadStack;
 
 typedef struct _easyDataBlock {
     httpsHeaders *headers;
+    bool ownHeaders;
     int bodyBytes;
     char *body;
     void *user;
+    // fired from a template (holding a reference until the worker starts it)
+    httpsPrepared *prepared;
+    char *query;
+    // a batch, the slots the worker starts together (this block rides on the first)
+    int *batch;
+    int batchCount;
+    // easyGetWith()
+    easyRequestOptions options;
+    bool hasOptions;
 } easyDataBlock;
 
+// easyMessage.handle in the slot table, a running slot holds its request index instead
+#define EASY_SLOT_FREE      -1      // unused
+#define EASY_SLOT_CLAIMED   -2      // being filled in by the main thread
+#define EASY_SLOT_READY     -3      // waiting for the worker to start it
+#define EASY_SLOT_FAILED    -4      // the request could not be started, waiting for release
+
+// threaded handles grow to this many as they run out, the slot arrays and rings are reserved
+// for all of them up front so they never move under the worker (untouched pages cost nothing)
+#define EASY_SLOT_MAX       16384
+
+#define EASY_CMD_RELEASE    0x40000000
+#define EASY_CMD_BATCH      0x20000000      // the slot leads a batch, see easyGetMany()
+
+// how long the worker sleeps when nobody wakes it
+#define EASY_WORKER_IDLE_MS 100
+
 pthread_t _thread;
 easyThreadStack *_threadStack = NULL;
-easyMetric _metricTable[MAX_REQUEST];
+// indexed by request handle, grows along with the request table
+easyMetric *_metricTable = NULL;
+int _metricCapacity = 0;
 unsigned int _easyOptions = 0;
 double _easyDelay = 0.0;
 
 #define EASY_THREADED       ((_threadStack != NULL) && (_threadStack->version == HTTPS_VERSION_NUM))
-#define EASY_OPT_FLAGS      1
-#define EASY_OPT_DELAY      2
 
 #define EASY_FLAG_ALL       0xFFFFFFFF
 #define EASY_METRICS        (_easyOptions & 0x0001)
+#define EASY_CHUNKED        (_easyOptions & 0x0002)     // lua gets and posts keep bodies as pooled chunks
 
 #define EASY_METRIC_HANDLE      0
 #define EASY_METRIC_URL         1
 #define EASY_METRIC_MIME        2
-#define EASY_METRIC_START       3
+#define EASY_METRIC_START       3       // on the _getSeconds() clock, which is monotonic
 #define EASY_METRIC_RATE        4
 #define EASY_METRIC_BYTES       5
 #define EASY_METRIC_TOTALBYTES  6
@@ -723,13 +2105,8 @@ void easyFlush(int index, const char* URL, void *user, memBuffer *p) {
     }
 }
 
-xthread_ret easyWorkerThread(void *p) {
-    bool done = false;
-    while (!done) {
-        usleep(5000);
-    }
-    return (xthread_ret)0;
-}
+xthread_ret easyWorkerThread(void *p);
+static void easyWake();
 
 void easySetup(easyCallback cb, unsigned int bsize)
 {
@@ -751,28 +2128,82 @@ void easySetupThreaded(easyCallback cb, unsigned int msgQueDepth, unsigned int s
     easyThreadStack *ps = _threadStack;
     ps->msgLimit = msgQueDepth;
     ps->slotLimit = slotCount;
-    ps->msg = mem.calloc(1, sizeof(easyMessage) * ps->msgLimit);
+    ps->slotCapacity = (slotCount > EASY_SLOT_MAX) ? slotCount : EASY_SLOT_MAX;
+    ps->msg = easyRingNew(ps->msgLimit, sizeof(easyMessage));
     if (ps->msg == NULL) return;
-    ps->slot = mem.calloc(1, sizeof(easyMessage) * ps->slotLimit);
+    ps->slot = mem.calloc(ps->slotCapacity, sizeof(easyMessage));
     if (ps->slot == NULL) return;
-    pthread_mutex_init(&ps->msgLock, NULL);
-    pthread_mutex_init(&ps->slotLock, NULL);
-    // make all the messages and slots invalid
-    pthread_mutex_lock(&ps->msgLock);
-    for (int i = 0; i < ps->msgLimit; i++)
-        ps->msg[i].handle = -1;
-    pthread_mutex_unlock(&ps->msgLock);
-    pthread_mutex_lock(&ps->slotLock);
-    for (int i = 0; i < ps->slotLimit; i++)
-        ps->slot[i].handle = -1;
-    pthread_mutex_unlock(&ps->slotLock);
+    // a slot has at most a start and a release queued at once
+    ps->freeSlots = easyRingNew(ps->slotCapacity, sizeof(int));
+    ps->commands = easyRingNew(ps->slotCapacity * 2, sizeof(int));
+    ps->slotRelease = mem.calloc(ps->slotCapacity, sizeof(bool));
+    ps->slotGen = mem.calloc(ps->slotCapacity, sizeof(unsigned int));
+    ps->slotReq = mem.calloc(ps->slotCapacity, sizeof(httpsReq*));
+    ps->deferred = mem.calloc(ps->slotCapacity, sizeof(int));
+    if ((ps->freeSlots == NULL) || (ps->commands == NULL) || (ps->slotRelease == NULL) || (ps->slotGen == NULL) || (ps->slotReq == NULL) ||
+        (ps->deferred == NULL)) return;
+    pthread_mutex_init(&ps->wakeLock, NULL);
+    pthread_cond_init(&ps->wake, NULL);
+    // make all the slots invalid and free
+    for (int i = 0; i < ps->slotLimit; i++) {
+        ps->slot[i].handle = EASY_SLOT_FREE;
+        easyRingPush(ps->freeSlots, &i);
+    }
     ps->version = HTTPS_VERSION_NUM;
+    // the https layer pokes the worker whenever a transfer has news
+    con.notify = easyWake;
     xthread_create(&_thread, easyWorkerThread, NULL);
 }
 
+// the request behind an easy handle, which is a slot when threaded
+static httpsReq* _easyReq(int h) {
+    if EASY_THREADED {
+        int i;
+        if ((h < 0) || (h >= _threadStack->slotLimit)) return NULL;
+        i = xatomic_load(&_threadStack->slot[h].handle);
+        return (i < 0) ? NULL : _liveReq(i);
+    }
+    return _liveReq(h);
+}
+
 void easyListhttpsHeaders(int h, httpsHeaderLister lister)
 {
-    httpsListhttpsHeaders(con.requestTable[h], lister);
+    httpsReq *r = _easyReq(h);
+    if (r != NULL) httpsListhttpsHeaders(r, lister);
+}
+
+// done with a handle: the request goes back to the pool (threaded, the worker does that)
+void easyRelease(int h)
+{
+    if EASY_THREADED {
+        easyThreadStack *ps = _threadStack;
+        int cmd = h | EASY_CMD_RELEASE;
+        if ((h < 0) || (h >= ps->slotLimit)) return;
+        if (xatomic_load(&ps->slot[h].handle) == EASY_SLOT_FREE) return;
+        // once per claim, which also guarantees the command ring has room
+        if (xatomic_exchange(&ps->slotRelease[h], true)) return;
+        xatomic_add(&ps->slotGen[h], 1);
+        // events still being read may point at this slot's url, the worker frees it on release
+        if (_eventCallouts > 0) {
+            ps->deferred[ps->deferredCount++] = h;
+            return;
+        }
+        easyRingPush(ps->commands, &cmd);
+        easyWake();
+        return;
+    }
+    httpsReq *r = _liveReq(h);
+    if (r == NULL) return;
+    easyData *d = (easyData*)r->userData;
+    // same as easyWorkerRelease(), a streamed transfer stops staging and the sink aborts it
+    _ENTER_REQ(r)
+    r->sinkUser = NULL;
+    if (d != NULL) {
+        mem.free(d->chunk.data);
+        memset(&d->chunk, 0, sizeof(memBuffer));
+    }
+    _EXIT_REQ(r)
+    httpsFinished(r);
 }
 
 void easyOptionUI(unsigned int opt, unsigned int val) {
@@ -783,6 +2214,45 @@ void easyOptionUI(unsigned int opt, unsigned int val) {
         case EASY_OPT_DELAY:
             _easyDelay = (double)val * 0.0000001;
             break;
+        case EASY_OPT_BACKEND:
+            naettConfigure(naettConfigBackend, val);
+            break;
+        case EASY_OPT_WORKERS:
+            naettConfigure(naettConfigWorkers, val);
+            break;
+        case EASY_OPT_REQUESTS:
+            httpsReserveRequests(val);
+            break;
+        case EASY_OPT_HANDLES:
+            naettConfigure(naettConfigHandlePool, (int)val);
+            break;
+        case EASY_OPT_DNS_TTL:
+            naettConfigure(naettConfigDNSCacheTimeout, (int)val);
+            break;
+        case EASY_OPT_CONNECTIONS:
+            naettConfigure(naettConfigMaxConnects, val);
+            break;
+        case EASY_OPT_HTTP:
+            naettConfigure(naettConfigHTTPVersion, val);
+            break;
+        case EASY_OPT_STREAMS:
+            naettConfigure(naettConfigMaxStreams, val);
+            break;
+        case EASY_OPT_HOST_CONNECTIONS:
+            naettConfigure(naettConfigMaxHostConnections, val);
+            break;
+        case EASY_OPT_TOTAL_CONNECTIONS:
+            naettConfigure(naettConfigMaxTotalConnections, val);
+            break;
+        case EASY_OPT_STREAM_WEIGHT:
+            naettConfigure(naettConfigStreamWeight, val);
+            break;
+        case EASY_OPT_ACTIVE:
+            httpsSetLimits((int)val, _hostLimit);
+            break;
+        case EASY_OPT_HOST_ACTIVE:
+            httpsSetLimits(_activeLimit, (int)val);
+            break;
         default:
             break;
     }
@@ -796,19 +2266,69 @@ void easyOptionD(unsigned int opt, double val) {
         case EASY_OPT_DELAY:
             _easyDelay = val;
             break;
+        case EASY_OPT_BACKEND:
+            naettConfigure(naettConfigBackend, (long)val);
+            break;
+        case EASY_OPT_WORKERS:
+            naettConfigure(naettConfigWorkers, (long)val);
+            break;
+        case EASY_OPT_REQUESTS:
+            httpsReserveRequests((unsigned int)val);
+            break;
+        case EASY_OPT_HANDLES:
+            naettConfigure(naettConfigHandlePool, (long)val);
+            break;
+        case EASY_OPT_DNS_TTL:
+            naettConfigure(naettConfigDNSCacheTimeout, (long)val);
+            break;
+        case EASY_OPT_CONNECTIONS:
+            naettConfigure(naettConfigMaxConnects, (long)val);
+            break;
+        case EASY_OPT_HTTP:
+            naettConfigure(naettConfigHTTPVersion, (long)val);
+            break;
+        case EASY_OPT_STREAMS:
+            naettConfigure(naettConfigMaxStreams, (long)val);
+            break;
+        case EASY_OPT_HOST_CONNECTIONS:
+            naettConfigure(naettConfigMaxHostConnections, (long)val);
+            break;
+        case EASY_OPT_TOTAL_CONNECTIONS:
+            naettConfigure(naettConfigMaxTotalConnections, (long)val);
+            break;
+        case EASY_OPT_STREAM_WEIGHT:
+            naettConfigure(naettConfigStreamWeight, (long)val);
+            break;
+        case EASY_OPT_ACTIVE:
+            httpsSetLimits((int)val, _hostLimit);
+            break;
+        case EASY_OPT_HOST_ACTIVE:
+            httpsSetLimits(_activeLimit, (int)val);
+            break;
         default:
             break;
     }
 }
 
+// metrics are kept per request, threaded handles are slots
+static inline int easyMetricIndex(int h) {
+    if EASY_THREADED {
+        httpsReq *r = _easyReq(h);
+        return (r != NULL) ? r->index : -1;
+    }
+    return h;
+}
+
 int easyHasMetrics(int i) {
-    if ((i < 0) || (i > MAX_REQUEST)) return 0;
+    i = easyMetricIndex(i);
+    if ((i < 0) || (i >= _metricCapacity)) return 0;
     return _metricTable[i].handle + 1;
 }
 
 int easyGetMetricI(int i, int w) {
     int secs;
-    if ((i < 0) || (i > MAX_REQUEST)) return 0;
+    i = easyMetricIndex(i);
+    if ((i < 0) || (i >= _metricCapacity)) return 0;
     switch (w) {
         case EASY_METRIC_HANDLE: return _metricTable[i].handle; break;
         case EASY_METRIC_BYTES: return (int)_metricTable[i].currentBytes; break;
@@ -826,7 +2346,8 @@ int easyGetMetricI(int i, int w) {
 
 double easyGetMetricD(int i, int w) {
     double secs;
-    if ((i < 0) || (i > MAX_REQUEST)) return 0;
+    i = easyMetricIndex(i);
+    if ((i < 0) || (i >= _metricCapacity)) return 0;
     switch (w) {
         case EASY_METRIC_HANDLE: return (double)_metricTable[i].handle; break;
         case EASY_METRIC_BYTES: return _metricTable[i].currentBytes; break;
@@ -843,7 +2364,8 @@ double easyGetMetricD(int i, int w) {
 }
 
 const char *easyGetMetricS(int i, int w) {
-    if ((i < 0) || (i > MAX_REQUEST)) return 0;
+    i = easyMetricIndex(i);
+    if ((i < 0) || (i >= _metricCapacity)) return 0;
     switch (w) {
         case EASY_METRIC_URL: return _metricTable[i].url; break;
         case EASY_METRIC_MIME: return _metricTable[i].mime; break;
@@ -851,102 +2373,517 @@ const char *easyGetMetricS(int i, int w) {
     return NULL;
 }
 
+// where easyDispatch() sends events, the user's callbacks through easyDeliver() or the worker's queue
+typedef void (*easyEmitter)(int handle, const char* url, int event, int code, unsigned int sz, void* data);
+
+// the generation a handle's events belong to, threaded handles are slots that get released and claimed again
+static inline unsigned int easyHandleGen(int handle)
+{
+    if (!EASY_THREADED || (handle < 0) || (handle >= _threadStack->slotLimit)) return 0;
+    return xatomic_load(&_threadStack->slotGen[handle]);
+}
+
+// user code runs between these, threaded releases it makes are held back until it returns so the
+// worker can't free a slot's url (or the slot be claimed again) while events naming it are being read
+static inline void easyCalloutBegin()
+{
+    _eventCallouts++;
+}
+
+static void easyCalloutEnd()
+{
+    if ((--_eventCallouts > 0) || !EASY_THREADED) return;
+    easyThreadStack *ps = _threadStack;
+    if (ps->deferredCount == 0) return;
+    for (int i = 0; i < ps->deferredCount; i++) {
+        int cmd = ps->deferred[i] | EASY_CMD_RELEASE;
+        easyRingPush(ps->commands, &cmd);
+    }
+    ps->deferredCount = 0;
+    easyWake();
+}
+
+// an event has been seen: its streamed bytes are freed, threaded a COMPLETE hands the slot back
+// (unless the handle was released since, then the slot may already be someone else's)
+static void easyEventDone(const easyEvent *e, unsigned int gen)
+{
+    if (e->event == EASY_EVENT_CHUNK) mem.free(e->data);
+    if ((e->event == EASY_EVENT_COMPLETE) && EASY_THREADED && (easyHandleGen(e->handle) == gen)) easyRelease(e->handle);
+}
+
+// hand the held events over in one call, anything the callback starts goes in the next batch
+static void easyFlushEvents()
+{
+    easyEvent *batch = _eventBatch;
+    unsigned int *gens = _eventGens;
+    int count = _eventCount;
+    int capacity = _eventCapacity;
+    int kept = 0;
+    if (count == 0) return;
+    _eventBatch = NULL;
+    _eventGens = NULL;
+    _eventCount = 0;
+    _eventCapacity = 0;
+    // anything released since it was held is dropped, its url may not be there any more
+    for (int i = 0; i < count; i++) {
+        if (easyHandleGen(batch[i].handle) == gens[i]) {
+            batch[kept] = batch[i];
+            gens[kept++] = gens[i];
+        } else if (batch[i].event == EASY_EVENT_CHUNK) mem.free(batch[i].data);
+    }
+    if (kept > 0) {
+        easyCalloutBegin();
+        _theEventCallback(batch, kept);
+        easyCalloutEnd();
+    }
+    for (int i = 0; i < kept; i++) easyEventDone(&batch[i], gens[i]);
+    // keep the arrays for next time unless the callback already needed new ones
+    if (_eventBatch == NULL) {
+        _eventBatch = batch;
+        _eventGens = gens;
+        _eventCapacity = capacity;
+    } else {
+        mem.free(batch);
+        mem.free(gens);
+    }
+}
+
+// room for one more held event, false when out of memory
+static bool easyHoldRoom()
+{
+    if (_eventCount < _eventCapacity) return true;
+    int grow = (_eventCapacity > 0) ? _eventCapacity * 2 : 64;
+    unsigned int *gens = mem.realloc(_eventGens, sizeof(unsigned int) * grow);
+    if (gens == NULL) return false;
+    _eventGens = gens;
+    easyEvent *grown = mem.realloc(_eventBatch, sizeof(easyEvent) * grow);
+    if (grown == NULL) return false;
+    _eventBatch = grown;
+    _eventCapacity = grow;
+    return true;
+}
+
+// give an event to whichever callback is set up, CHUNK data belongs to the event from here on
+static void easyDeliver(int handle, const char* url, int event, int code, unsigned int sz, void* data)
+{
+    easyEvent e = { event, handle, url, code, sz, data };
+    unsigned int gen = easyHandleGen(handle);
+    if (_theEventCallback == NULL) {
+        if (_theEasyCallback != NULL) {
+            easyCalloutBegin();
+            _theEasyCallback(handle, url, _easyEventNames[event], code, sz, data);
+            easyCalloutEnd();
+        }
+        easyEventDone(&e, gen);
+        return;
+    }
+    if (_eventBatched) {
+        if (easyHoldRoom()) {
+            _eventGens[_eventCount] = gen;
+            _eventBatch[_eventCount++] = e;
+            return;
+        }
+        // out of memory, send what is held so the order stays right and this one on its own
+        easyFlushEvents();
+    }
+    easyCalloutBegin();
+    _theEventCallback(&e, 1);
+    easyCalloutEnd();
+    easyEventDone(&e, gen);
+}
+
+void easySetEventCallback(easyEventCallback cb, bool batched)
+{
+    // whatever is held goes to the callback it was collected for
+    easyFlushEvents();
+    _theEventCallback = cb;
+    _eventBatched = batched;
+}
+
+// a READ waits until the request has moved on far enough since the last one, or is complete
+static bool easyProgressDue(httpsReq *r, easyData *d)
+{
+    if (r->complete) return true;
+    if ((d->progressBytes > 0) && ((r->readTotalBytes - d->readTotalBytes) < d->progressBytes)) return false;
+    if (d->progressSeconds > 0.0) {
+        double now = _getSeconds();
+        if ((now - d->progressTime) < d->progressSeconds) return false;
+        d->progressTime = now;
+    }
+    return true;
+}
+
+// compare a request against what its handle has been told so far and send the differences to cb,
+// cb owns any CHUNK data it is given; direct means cb is easyDeliver() and the request is
+// handed back as soon as COMPLETE has been sent (otherwise whoever cb posts to does that)
+static void easyDispatch(httpsReq *r, easyEmitter cb, bool direct)
+{
+    easyData *d = (easyData*)r->userData;
+    int i;
+    // released (threaded) or not set up yet, nobody to tell
+    if (d == NULL) return;
+    i = d->handle;
+    // here we go, check for needed callbacks, etc.
+    if (r->returnCode != d->returnCode)
+    {
+        // a change of state, so mark that and do the callback!
+        if (easyWants(d, EASY_EVENT_UPDATE)) cb(i, r->URL, EASY_EVENT_UPDATE, r->returnCode, 0, NULL);
+        d->returnCode = r->returnCode;
+    }
+    if (r->headerDone != d->headerDone) {
+        // we have all the httpsHeaders!
+        if (easyWants(d, EASY_EVENT_HEADERS)) cb(i, r->URL, EASY_EVENT_HEADERS, r->returnCode, 0, (void*)_easyGetHeader);
+        d->headerDone = r->headerDone;
+    }
+    if (r->contentTotalBytes != d->contentTotalBytes) {
+        // we have size of the download, so let caller know
+        if (easyWants(d, EASY_EVENT_LENGTH)) cb(i, r->URL, EASY_EVENT_LENGTH, r->contentTotalBytes, 0, NULL);
+        d->contentTotalBytes = r->contentTotalBytes;
+    }
+    if (r->contentMimeType != d->contentMimeType) {
+        // we have mime type of the download, so let caller know
+        if (easyWants(d, EASY_EVENT_MIME)) cb(i, r->URL, EASY_EVENT_MIME, r->contentTotalBytes, strlen(r->contentMimeType), (void*)r->contentMimeType);
+        d->contentMimeType = r->contentMimeType;
+    }
+    if ((r->readTotalBytes != d->readTotalBytes) && easyWants(d, EASY_EVENT_READ) && easyProgressDue(r, d)) {
+        // we read more bytes! (enough of them since last time, if the request asked for that)
+        cb(i, r->URL, EASY_EVENT_READ, r->readTotalBytes, 0, NULL);
+        d->readTotalBytes = r->readTotalBytes;
+    }
+    if (r->sink == easyChunkSink) {
+        // streamed bytes go before COMPLETE, so the last of them is never missed
+        unsigned int bytes;
+        char *chunk = easyTakeChunk(r, d, &bytes);
+        if ((bytes > 0) && easyWants(d, EASY_EVENT_CHUNK)) cb(i, r->URL, EASY_EVENT_CHUNK, bytes, bytes, chunk);
+        else mem.free(chunk);
+    }
+    if (r->complete != d->complete) {
+        // response is complete, so let the caller know
+        // a chunked body isn't in the buffer, sz still says how long it is
+        unsigned int sz = (r->flags & HTTPS_CHUNK_BUFFER) ? httpsGetBodyLength(r) : r->buffer.end;
+        cb(i, r->URL, EASY_EVENT_COMPLETE, r->returnCode, sz, (void*)&r->buffer);
+        d->returnCode = r->returnCode;
+        d->complete = r->complete;
+        if (direct) httpsRelease(r);
+    }
+}
+
+static void easyCollectMetrics()
+{
+    double secs = _getSeconds();
+    pthread_mutex_lock(&con.mainLock);
+    // keep the metric table as large as the request table
+    if (_metricCapacity < con.requestCapacity) {
+        easyMetric *grown = mem.realloc(_metricTable, sizeof(easyMetric) * con.requestCapacity);
+        if (grown != NULL) {
+            _metricTable = grown;
+            _metricCapacity = con.requestCapacity;
+        }
+    }
+    // see what metrics we have to collect! (entries without a live request are marked invalid)
+    for (int i = 0; i < _metricCapacity; i++)
+    {
+        httpsReq* r = _liveReq(i);
+        easyMetric *m = &_metricTable[i];
+        m->handle = -1;
+        if (r != NULL) {
+            easyData *d = (easyData*)r->userData;
+            m->handle = (d != NULL) ? d->handle : i;
+            m->url = r->URL;
+            m->mime = r->contentMimeType;
+            m->startTime = r->startTime;
+            m->currentBytes = r->readTotalBytes;
+            m->totalBytes = r->contentTotalBytes;
+            if (m->currentBytes > 0.0) {
+                m->bytesPerSecond = m->currentBytes / (secs - m->startTime);
+            } else m->bytesPerSecond = 0.0;
+            if ((m->totalBytes > 0.0) && (m->bytesPerSecond > 0.0)) {
+                m->estimatedRemainingTime = (m->totalBytes - m->currentBytes) / m->bytesPerSecond;
+            } else m->estimatedRemainingTime = 0.0f;
+        }
+    }
+    pthread_mutex_unlock(&con.mainLock);
+}
+
+// threaded: hand the worker's messages to the easy callback, in the order they were posted
+static void easyDrainMessages()
+{
+    easyThreadStack *ps = _threadStack;
+    easyMessage m;
+    // at most one queue's worth, so a busy worker can't keep us here forever
+    for (int i = 0; (i < ps->msgLimit) && easyRingPop(ps->msg, &m); i++) {
+        // drop anything posted for a slot that has since been released (and maybe reused)
+        bool current = ((unsigned int)(size_t)m.user == xatomic_load(&ps->slotGen[m.slot]));
+        // once delivered a COMPLETE hands the request back, same as unthreaded
+        if (current) easyDeliver(m.handle, m.url, m.event, m.code, m.sz, m.data);
+        // streamed bytes belong to the message, delivered or not
+        else if (m.event == EASY_EVENT_CHUNK) mem.free(m.data);
+    }
+}
+
 // void (*easyCallback)(int handle, const char* url, const char* msg, int code, unsigned int sz, void* data);
 void easyUpdate()
 {
-    int mcnt = 0;
-    double secs;
-    // are we threaded? if so, why are we calling this? bug out
-    if EASY_THREADED return;
+    // starts held since last time go first, before httpsUpdate can drop a released request
+    easyFlushEvents();
+    // are we threaded? then the worker did the work, just deliver what it found
+    if EASY_THREADED {
+        easyDrainMessages();
+        easyFlushEvents();
+        return;
+    }
     // or... proceed and handle the update
     httpsUpdate();
-    pthread_mutex_lock(&con.mainLock);
-    for (int i = 0; i < MAX_REQUEST; i++)
+    // only requests httpsUpdate saw events for can have changed; requests are only deleted
+    // inside httpsUpdate, so no lock is needed here and callbacks are free to start new requests
+    for (int t = 0; t < con.touchedCount; t++)
     {
-        httpsReq* r = con.requestTable[i];
-        if (r != NULL) {
-            easyData *d = (easyData*)r->userData;
-            // here we go, check for needed callbacks, etc.
-            if (r->returnCode != d->returnCode)
-            {
-                // a change of state, so mark that and do the callback!
-                _theEasyCallback(i, r->URL, "UPDATE", r->returnCode, 0, NULL);
-                d->returnCode = r->returnCode;
-            }
-            if (r->headerDone != d->headerDone) {
-                // we have all the httpsHeaders!
-                _theEasyCallback(i, r->URL, "httpsHeaders", r->returnCode, 0, (void*)_easyGetHeader);
-                d->headerDone = r->headerDone;
-            }
-            if (r->contentTotalBytes != d->contentTotalBytes) {
-                // we have size of the download, so let caller know
-                _theEasyCallback(i, r->URL, "LENGTH", r->contentTotalBytes, 0, NULL);
-                d->contentTotalBytes = r->contentTotalBytes;
-            }
-            if (r->contentMimeType != d->contentMimeType) {
-                // we have mime type of the download, so let caller know
-                _theEasyCallback(i, r->URL, "MIME", r->contentTotalBytes, strlen(r->contentMimeType), (void*)r->contentMimeType);
-                d->contentMimeType = r->contentMimeType;
-            }
-            if (r->readTotalBytes != d->readTotalBytes) {
-                // we read more bytes!
-                _theEasyCallback(i, r->URL, "READ", r->readTotalBytes, 0, NULL);
-                d->readTotalBytes = r->readTotalBytes;
-            }
-            if (r->complete != d->complete) {
-                // response is complete, so let the caller know
-                _theEasyCallback(i, r->URL, "COMPLETE", r->returnCode, r->buffer.end, (void*)&r->buffer);
-                d->returnCode = r->returnCode;
-                httpsRelease(r);
-            }
+        httpsReq* r = _liveReq(con.touched[t]);
+        if (r != NULL) easyDispatch(r, easyDeliver, true);
+    }
+    easyFlushEvents();
+    
+    // are we doing metrics? if so update them
+    if EASY_METRICS easyCollectMetrics();
+
+    // sleep for the request delay amount if we are being nice
+    if (_easyDelay > 0.0) usleep((useconds_t)(_easyDelay * 1000000));
+}
+
+// threaded: queue a message for the main thread, this is an easyEmitter so easyDispatch()
+// can feed it directly; when the queue is full we wait for the main thread
+static void easyPostMessage(int handle, const char* url, int event, int code, unsigned int sz, void* data)
+{
+    easyThreadStack *ps = _threadStack;
+    easyMessage m;
+    m.version = HTTPS_VERSION_NUM;
+    m.slot = handle;
+    m.handle = handle;
+    m.url = url;
+    strcpy(m.message, _easyEventNames[event]);
+    m.event = event;
+    m.code = code;
+    m.sz = sz;
+    m.data = data;
+    m.user = (void*)(size_t)xatomic_load(&ps->slotGen[handle]);
+    m.flush = NULL;
+    while (!easyRingPush(ps->msg, &m)) {
+        if (ps->quit) return;
+        usleep(1000);
+    }
+}
+
+// threaded: something happened for the worker to look at, only costs a lock if it is asleep
+static void easyWake()
+{
+    easyThreadStack *ps = _threadStack;
+    // pairs with the fence in easyWorkerSleep(), either we see it asleep or it sees our work
+    xatomic_fence();
+    if (!xatomic_load(&ps->sleeping)) return;
+    pthread_mutex_lock(&ps->wakeLock);
+    pthread_cond_signal(&ps->wake);
+    pthread_mutex_unlock(&ps->wakeLock);
+}
+
+// worker: wait for commands or transfer events, or a while to pass
+static void easyWorkerSleep()
+{
+    easyThreadStack *ps = _threadStack;
+    struct timespec ts;
+    pthread_mutex_lock(&ps->wakeLock);
+    xatomic_store(&ps->sleeping, 1);
+    xatomic_fence();
+    if (!ps->quit && easyRingEmpty(ps->commands) && (xatomic_load(&con.eventHead) == NULL)) {
+        ms_to_timespec(&ts, EASY_WORKER_IDLE_MS);
+        pthread_cond_timedwait(&ps->wake, &ps->wakeLock, &ts);
+    }
+    xatomic_store(&ps->sleeping, 0);
+    pthread_mutex_unlock(&ps->wakeLock);
+}
+
+static void easyWorkerStarted(int slot, httpsReq *r, easyData *d);
+
+// what easyGetWith() asks for beyond a plain get, once the request exists
+static void easyApplyOptions(httpsReq *r, easyData *d, const easyRequestOptions *options)
+{
+    if (options->deadline > 0.0) httpsSetDeadline(r, options->deadline);
+    // the event COMPLETE hands the request back on, so it can't be masked off
+    d->events = options->events ? (options->events | EASY_EVENT_MASK(EASY_EVENT_COMPLETE)) : 0;
+    d->progressBytes = options->progressBytes;
+    d->progressSeconds = options->progressSeconds;
+}
+
+static void easyFreeDataBlock(easyDataBlock *b)
+{
+    if (b == NULL) return;
+    if (b->ownHeaders && (b->headers != NULL)) httpsDelhttpsHeaders(b->headers);
+    if (b->prepared != NULL) _preparedDrop(b->prepared);
+    mem.free(b->query);
+    mem.free(b->body);
+    mem.free(b->batch);
+    mem.free(b);
+}
+
+// worker: start the request a slot describes
+static void easyWorkerStart(int slot)
+{
+    easyThreadStack *ps = _threadStack;
+    easyMessage *m = &ps->slot[slot];
+    easyDataBlock *b = (easyDataBlock*)m->data;
+    httpsHeaders *h = (b != NULL) ? b->headers : NULL;
+    httpsReq *r = NULL;
+
+    // streamed (gets and fires only), the sink needs its staging area before the first byte can arrive
+    easyData *d = ((m->code & HTTPS_STREAM) && (!strcmp(m->message, "GET") || !strcmp(m->message, "FIRE"))) ? easyNewData(slot) : NULL;
+
+    if (!strcmp(m->message, "FIRE")) {
+        if (b != NULL) r = _fire(b->prepared, m->code, b->query, b->body, b->bodyBytes, (d != NULL) ? easyChunkSink : NULL, d);
+    }
+    else if (!strcmp(m->message, "GET")) {
+        if (d != NULL) r = httpsGetStreamed(m->url, m->code, h, easyChunkSink, d);
+            else r = httpsGet(m->url, m->code, h);
+    }
+    else if (!strcmp(m->message, "POST")) r = httpsPost(m->url, m->code, (b != NULL) ? b->body : NULL, (b != NULL) ? b->bodyBytes : 0, h);
+    else if (!strcmp(m->message, "HEAD")) r = httpsHead(m->url, m->code, h);
+    if ((r != NULL) && (b != NULL) && b->hasOptions) {
+        if (d == NULL) d = easyNewData(slot);
+        easyApplyOptions(r, d, &b->options);
+    }
+    // the request has its own copies now
+    easyFreeDataBlock(b);
+    m->data = NULL;
+    easyWorkerStarted(slot, r, d);
+}
+
+// worker: start every slot of a batch with one submit
+static void easyWorkerStartBatch(int lead)
+{
+    easyThreadStack *ps = _threadStack;
+    easyDataBlock *b = (easyDataBlock*)ps->slot[lead].data;
+    int n = b->batchCount;
+    const char **urls = mem.malloc((sizeof(const char*) + sizeof(void*)) * n);
+    void **out = (void**)(urls + n);
+
+    if (urls != NULL) {
+        for (int i = 0; i < n; i++) urls[i] = ps->slot[b->batch[i]].url;
+        httpsSubmitBatch(ps->slot[lead].message, urls, n, ps->slot[lead].code, b->headers, out);
+    }
+    for (int i = 0; i < n; i++) easyWorkerStarted(b->batch[i], (urls != NULL) ? (httpsReq*)out[i] : NULL, NULL);
+    mem.free(urls);
+    easyFreeDataBlock(b);
+    ps->slot[lead].data = NULL;
+}
+
+// worker: a slot's request has started (or failed to, NULL), d is its easyData if it already has one
+static void easyWorkerStarted(int slot, httpsReq *r, easyData *d)
+{
+    easyThreadStack *ps = _threadStack;
+    easyMessage *m = &ps->slot[slot];
+
+    if (r != NULL) {
+        if (d == NULL) d = easyNewData(slot);
+        d->user = m->user;
+        r->userData = d;
+    } else mem.free(d);
+    ps->slotReq[slot] = r;
+    xatomic_store(&m->handle, (r != NULL) ? r->index : EASY_SLOT_FAILED);
+
+    if (r == NULL) {
+        // nothing to wait for, the main thread releases it when it sees this
+        easyPostMessage(slot, m->url, EASY_EVENT_COMPLETE, naettGenericError, 0, NULL);
+        return;
+    }
+    if (easyWants(d, EASY_EVENT_START)) easyPostMessage(slot, m->url, EASY_EVENT_START, r->returnCode, 0, NULL);
+}
+
+// worker: the main thread is done with a slot, hand its request back and free it up
+static void easyWorkerRelease(int slot)
+{
+    easyThreadStack *ps = _threadStack;
+    easyMessage *m = &ps->slot[slot];
+    httpsReq *r = ps->slotReq[slot];
+
+    if (r != NULL) {
+        easyData *d = (easyData*)r->userData;
+        r->userData = NULL;
+        // stop a streamed transfer from staging into what we are about to free
+        _ENTER_REQ(r)
+        r->sinkUser = NULL;
+        _EXIT_REQ(r)
+        if (d != NULL) {
+            if ((m->flush != NULL) && (d->user != NULL)) fclose((FILE*)d->user);
+            mem.free(d->chunk.data);
+            mem.free(d);
         }
+        httpsRelease(r);
     }
-    pthread_mutex_unlock(&con.mainLock);
-    
-    // are we doing metrics? if so update them
-    if EASY_METRICS {
-        secs = _getSeconds();
-        pthread_mutex_lock(&con.mainLock);
-        // empty the metric table (just mark every entry invalid)
-        for (int i = 0; i < MAX_REQUEST; i++)
-            _metricTable[i].handle = -1;
-        // see what metrics we have to collect!
-        for (int i = 0; i < MAX_REQUEST; i++)
+    mem.free((void*)m->url);
+    ps->slotReq[slot] = NULL;
+    m->url = NULL;
+    m->version = 0;
+    xatomic_store(&m->handle, EASY_SLOT_FREE);
+    xatomic_store(&ps->slotRelease[slot], false);
+    // the free ring has room for every slot, so this can't fail
+    easyRingPush(ps->freeSlots, &slot);
+}
+
+xthread_ret easyWorkerThread(void *p) {
+    easyThreadStack *ps = _threadStack;
+    int cmd;
+
+    while (!ps->quit) {
+        // sleep until there is a command or a transfer event (or a while passes)
+        easyWorkerSleep();
+        // commands come in the order they were queued, so a start always beats its release
+        while (easyRingPop(ps->commands, &cmd)) {
+            if (cmd & EASY_CMD_RELEASE) easyWorkerRelease(cmd & ~EASY_CMD_RELEASE);
+                else if (cmd & EASY_CMD_BATCH) easyWorkerStartBatch(cmd & ~EASY_CMD_BATCH);
+                else easyWorkerStart(cmd);
+        }
+
+        // drive the https layer and turn what changed into messages
+        httpsUpdate();
+        for (int t = 0; t < con.touchedCount; t++)
         {
-            httpsReq* r = con.requestTable[i];
-            if (r != NULL) {
-                _metricTable[mcnt].handle = i;
-                _metricTable[mcnt].url = r->URL;
-                _metricTable[mcnt].mime = r->contentMimeType;
-                _metricTable[mcnt].startTime = r->startTime;
-                _metricTable[mcnt].currentBytes = r->readTotalBytes;
-                _metricTable[mcnt].totalBytes = r->contentTotalBytes;
-                if (_metricTable[mcnt].currentBytes > 0.0) {
-                    _metricTable[mcnt].bytesPerSecond = _metricTable[mcnt].currentBytes / (secs - _metricTable[mcnt].startTime);
-                } else _metricTable[mcnt].bytesPerSecond = 0.0;
-                if ((_metricTable[mcnt].totalBytes > 0.0) && (_metricTable[mcnt].bytesPerSecond > 0.0)) {
-                    _metricTable[mcnt].estimatedRemainingTime = (_metricTable[mcnt].totalBytes - _metricTable[mcnt].currentBytes) / _metricTable[mcnt].bytesPerSecond;
-                } else _metricTable[mcnt].estimatedRemainingTime = 0.0f;
-            }
+            httpsReq* r = _liveReq(con.touched[t]);
+            if (r != NULL) easyDispatch(r, easyPostMessage, false);
         }
-        pthread_mutex_unlock(&con.mainLock);
+        if EASY_METRICS easyCollectMetrics();
     }
+    return (xthread_ret)0;
+}
 
-    // sleep for the request delay amount if we are being nice
-    if (_easyDelay > 0.0) usleep((useconds_t)(_easyDelay * 1000000));
+// all the slots are taken, hand out more of the reserved ones (main thread)
+static bool easyGrowSlots() {
+    easyThreadStack *ps = _threadStack;
+    int from = ps->slotLimit;
+    int to = (from * 2 < ps->slotCapacity) ? from * 2 : ps->slotCapacity;
+    if (from >= to) return false;
+    for (int i = from; i < to; i++) {
+        ps->slot[i].handle = EASY_SLOT_FREE;
+        easyRingPush(ps->freeSlots, &i);
+    }
+    ps->slotLimit = to;
+    return true;
 }
 
 static inline int easyFreeSlot() {
-    int ret = -1, i;
-    pthread_mutex_lock(&_threadStack->slotLock);
-    for (i = 0; i < _threadStack->slotLimit; i++)
-        if (_threadStack->slot[i].handle == -1) {
-            _threadStack->slot[i].handle = HTTPS_OPEN_HANDLE;
-            break;
-        }
-    pthread_mutex_unlock(&_threadStack->slotLock);
-    if (i < _threadStack->slotLimit) ret = i;
-    return ret;
+    int slot;
+    // more handles than slots just means more slots, the https layer queues what it can't run yet
+    if (!easyRingPop(_threadStack->freeSlots, &slot) && (!easyGrowSlots() || !easyRingPop(_threadStack->freeSlots, &slot))) return -1;
+    xatomic_store(&_threadStack->slot[slot].handle, EASY_SLOT_CLAIMED);
+    xatomic_add(&_threadStack->slotGen[slot], 1);
+    return slot;
+}
+
+// a filled in slot goes over to the worker
+static inline void easySubmitSlot(int slot) {
+    easyThreadStack *ps = _threadStack;
+    ps->slot[slot].version = HTTPS_VERSION_NUM;
+    xatomic_store(&ps->slot[slot].handle, EASY_SLOT_READY);
+    // the command ring has room for a start and a release per slot, so this can't fail
+    easyRingPush(ps->commands, &slot);
+    easyWake();
 }
 
 static inline easyDataBlock* easyMakeDataBlock(const char *body, unsigned int bodyBytes, const char* *_httpsHeaders, int header_count, bool header_compact) {
@@ -962,25 +2899,9 @@ static inline easyDataBlock* easyMakeDataBlock(const char *body, unsigned int bo
         }
         memcpy(d->body, body, bodyBytes);
     }
-    // copy the header data if needed
+    // copy the header data if needed, packed like any other header block
     if (_httpsHeaders != NULL && header_count > 0) {
-        d->headers = mem.malloc(sizeof(httpsHeaders));
-        d->headers->count = header_count;
-        if (header_compact) {
-            for (int i = 0; i < header_count; i++) {
-                char *k, *v;
-                char *tst = memStrdup(_httpsHeaders[i]);
-                _stringSep(tst, &k, &v);
-                d->headers->str[i*2] = memStrdup(k);
-                d->headers->str[i*2+1] = memStrdup(v);
-                mem.free(tst);
-            }
-        } else {
-            for (int i = 0; i < header_count; i++) {
-                d->headers->str[i*2] = memStrdup(_httpsHeaders[i*2]);
-                d->headers->str[i*2+1] = memStrdup(_httpsHeaders[i*2+1]);
-            }
-        }
+        d->headers = _easyCreateHeaders(_httpsHeaders, header_count, header_compact);
     }
     return d;
 }
@@ -1003,8 +2924,11 @@ static inline easyDataBlock* easyMakeDataBlockPass(const char *body, unsigned in
     return d;
 }
 
+// slot commands: message is the method, code the request flags, data an easyDataBlock (or NULL),
+// flush/user are set for file downloads
 static inline int easyThreadedSlot(const char *mode, const char *URL, int flags, const char *body, unsigned int bodyBytes, 
-                                        const char* *_httpsHeaders, int header_count, bool header_compact) {
+                                        const char* *_httpsHeaders, int header_count, bool header_compact, FILE *fp,
+                                        const easyRequestOptions *options) {
     int slot = easyFreeSlot();
     if (slot < 0) return slot;
     easyMessage *m = &_threadStack->slot[slot];
@@ -1012,13 +2936,23 @@ static inline int easyThreadedSlot(const char *mode, const char *URL, int flags,
     m->slot = slot;
     m->url = memStrdup(URL);
     strcpy(m->message, mode);
-    m->code = 0;
+    m->code = flags;
     m->sz = 0;
-    if (((header_count > 0) && (_httpsHeaders != NULL)) || ((body != NULL) && (bodyBytes > 0))) 
-        m->data = easyMakeDataBlock(body, bodyBytes, _httpsHeaders, header_count, header_compact);
-    else
+    m->flush = (fp != NULL) ? (void*)easyFlush : NULL;
+    m->user = (void*)fp;
+    if (((header_count > 0) && (_httpsHeaders != NULL)) || ((body != NULL) && (bodyBytes > 0)) || (options != NULL)) {
+        easyDataBlock *b = easyMakeDataBlock(body, bodyBytes, _httpsHeaders, header_count, header_compact);
+        if (b != NULL) {
+            b->ownHeaders = true;
+            if (options != NULL) {
+                b->options = *options;
+                b->hasOptions = true;
+            }
+        }
+        m->data = b;
+    } else
         m->data = NULL;
-    m->version = HTTPS_VERSION_NUM;
+    easySubmitSlot(slot);
     return slot;
 }
 
@@ -1031,34 +2965,48 @@ static inline int easyThreadedSlotPass(const char *mode, const char *URL, int fl
     m->slot = slot;
     m->url = memStrdup(URL);
     strcpy(m->message, mode);
-    m->code = 0;
+    m->code = flags;
     m->sz = 0;
+    m->flush = NULL;
+    m->user = NULL;
     if ((h != NULL) || ((body != NULL) && (bodyBytes > 0))) 
         m->data = easyMakeDataBlockPass(body, bodyBytes, h);
     else
         m->data = NULL;
-    m->version = HTTPS_VERSION_NUM;
+    easySubmitSlot(slot);
     return slot;
 }
 
 int easyGet(const char *URL, int flags, const char* *_httpsHeaders, int header_count, bool header_compact) {
-    httpsHeaders *h;
+    return easyGetWith(URL, flags, _httpsHeaders, header_count, header_compact, NULL);
+}
+
+int easyGetWith(const char *URL, int flags, const char* *_httpsHeaders, int header_count, bool header_compact,
+                    const easyRequestOptions *options) {
+    httpsHeaders *h = NULL;
     httpsReq *r;
+    easyData *d;
 
     // are we threaded? if so, we just populate a message slot and leave
     if EASY_THREADED {
-        return easyThreadedSlot("GET", URL, flags, NULL, 0, _httpsHeaders, header_count, header_compact);
+        return easyThreadedSlot("GET", URL, flags, NULL, 0, _httpsHeaders, header_count, header_compact, NULL, options);
     }
 
     if ((header_count > 0) && (_httpsHeaders != NULL))
-    {
         h = _easyCreateHeaders(_httpsHeaders, header_count, header_compact);
-        r = httpsGet(URL, flags, h);
-        httpsDelhttpsHeaders(h);
-    } else
-        r = httpsGet(URL, flags, NULL);
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    // the handle isn't known until the request exists, but streamed chunks can arrive before that
+    d = easyNewData(-1);
+    if (flags & HTTPS_STREAM) r = httpsGetStreamed(URL, flags, h, easyChunkSink, d);
+        else r = httpsGet(URL, flags, h);
+    if (h != NULL) httpsDelhttpsHeaders(h);
+    if (r == NULL) {
+        mem.free(d);
+        return -1;
+    }
+    d->handle = r->index;
+    if (options != NULL) easyApplyOptions(r, d, options);
+    r->userData = d;
+    if (easyWants(d, EASY_EVENT_START)) easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1068,9 +3016,10 @@ int easyGetFile(const char *URL, const char *ofname, const char* *_httpsHeaders,
 
     // are we threaded? if so, we just populate a message slot and leave
     if EASY_THREADED {
-        int slot = easyThreadedSlot("GET", URL, HTTPS_REUSE_BUFFER, NULL, 0, _httpsHeaders, header_count, header_compact);
-        _threadStack->slot[slot].flush = (void*)easyFlush;
-        _threadStack->slot[slot].user = (void*)fopen(ofname, "wb");
+        FILE *fp = fopen(ofname, "wb");
+        if (fp == NULL) return -1;
+        int slot = easyThreadedSlot("GET", URL, HTTPS_REUSE_BUFFER, NULL, 0, _httpsHeaders, header_count, header_compact, fp, NULL);
+        if (slot < 0) fclose(fp);
         return slot;
     }
 
@@ -1081,10 +3030,11 @@ int easyGetFile(const char *URL, const char *ofname, const char* *_httpsHeaders,
         httpsDelhttpsHeaders(h);
     } else
         r = httpsGet(URL, HTTPS_REUSE_BUFFER, NULL);
-    easyData *d = mem.calloc(1, sizeof(easyData));
+    if (r == NULL) return -1;
+    easyData *d = easyNewData(r->index);
     d->user = (void*)fopen(ofname, "wb");
     r->userData = d;
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1094,7 +3044,7 @@ int easyPost(const char *URL, int flags, const char *body, unsigned int bodyByte
 
     // are we threaded? if so, we just populate a message slot and leave
     if EASY_THREADED {
-        return easyThreadedSlot("POST", URL, flags, body, bodyBytes, _httpsHeaders, header_count, header_compact);
+        return easyThreadedSlot("POST", URL, flags, body, bodyBytes, _httpsHeaders, header_count, header_compact, NULL, NULL);
     }
 
     if ((header_count > 0) && (_httpsHeaders != NULL))
@@ -1104,8 +3054,9 @@ int easyPost(const char *URL, int flags, const char *body, unsigned int bodyByte
         httpsDelhttpsHeaders(h);
     } else
         r = httpsPost(URL, flags, body, bodyBytes, NULL);
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    if (r == NULL) return -1;
+    r->userData = easyNewData(r->index);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1114,7 +3065,7 @@ int easyHead(const char *URL, int flags, const char* *_httpsHeaders, int header_
     httpsReq *r;
 
     if EASY_THREADED {
-        return easyThreadedSlot("HEAD", URL, flags, NULL, 0, _httpsHeaders, header_count, header_compact);
+        return easyThreadedSlot("HEAD", URL, flags, NULL, 0, _httpsHeaders, header_count, header_compact, NULL, NULL);
     }
 
     if ((header_count > 0) && (_httpsHeaders != NULL))
@@ -1124,8 +3075,9 @@ int easyHead(const char *URL, int flags, const char* *_httpsHeaders, int header_
         httpsDelhttpsHeaders(h);
     } else
         r = httpsHead(URL, flags, NULL);
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    if (r == NULL) return -1;
+    r->userData = easyNewData(r->index);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1138,8 +3090,9 @@ int easyGetPass(const char *URL, int flags, httpsHeaders *h) {
     }
 
     r = httpsGet(URL, flags, h);
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    if (r == NULL) return -1;
+    r->userData = easyNewData(r->index);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1152,8 +3105,9 @@ int easyPostPass(const char *URL, int flags, const char *body, unsigned int body
     }
 
     r = httpsPost(URL, flags, body, bodyBytes, h);
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    if (r == NULL) return -1;
+    r->userData = easyNewData(r->index);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
@@ -1165,13 +3119,172 @@ int easyHeadPass(const char *URL, int flags, httpsHeaders *h) {
     }
 
     r = httpsHead(URL, flags, h);    
-    r->userData = mem.calloc(1, sizeof(easyData));
-    _theEasyCallback(r->index, r->URL, "START", r->returnCode, 0, NULL);
+    if (r == NULL) return -1;
+    r->userData = easyNewData(r->index);
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
+    return r->index;
+}
+
+int easyGetMany(const char* *URLs, int count, int flags, const char* *_httpsHeaders, int header_count, bool header_compact, int *handles) {
+    httpsHeaders *h = NULL;
+    int i, n = 0;
+
+    if ((URLs == NULL) || (handles == NULL) || (count <= 0)) return 0;
+    flags &= ~HTTPS_STREAM;
+    // are we threaded? a slot each, but one command (and one wakeup) for the lot
+    if EASY_THREADED {
+        int *slots = mem.malloc(sizeof(int) * count);
+        easyDataBlock *b = (slots != NULL) ? easyMakeDataBlock(NULL, 0, _httpsHeaders, header_count, header_compact) : NULL;
+        if (b == NULL) {
+            mem.free(slots);
+            for (i = 0; i < count; i++) handles[i] = -1;
+            return 0;
+        }
+        b->ownHeaders = true;
+        for (i = 0; i < count; i++) {
+            int slot = (URLs[i] != NULL) ? easyFreeSlot() : -1;
+            handles[i] = slot;
+            if (slot < 0) continue;
+            easyMessage *m = &_threadStack->slot[slot];
+            m->version = 0;
+            m->slot = slot;
+            m->url = memStrdup(URLs[i]);
+            strcpy(m->message, "GET");
+            m->code = flags;
+            m->sz = 0;
+            m->flush = NULL;
+            m->user = NULL;
+            m->data = NULL;
+            slots[n++] = slot;
+        }
+        if (n == 0) {
+            easyFreeDataBlock(b);
+            mem.free(slots);
+            return 0;
+        }
+        b->batch = slots;
+        b->batchCount = n;
+        _threadStack->slot[slots[0]].data = b;
+        for (i = 0; i < n; i++) {
+            _threadStack->slot[slots[i]].version = HTTPS_VERSION_NUM;
+            xatomic_store(&_threadStack->slot[slots[i]].handle, EASY_SLOT_READY);
+        }
+        int cmd = slots[0] | EASY_CMD_BATCH;
+        easyRingPush(_threadStack->commands, &cmd);
+        easyWake();
+        return n;
+    }
+
+    void **out = mem.malloc(sizeof(void*) * count);
+    if (out == NULL) {
+        for (i = 0; i < count; i++) handles[i] = -1;
+        return 0;
+    }
+    if ((header_count > 0) && (_httpsHeaders != NULL))
+        h = _easyCreateHeaders(_httpsHeaders, header_count, header_compact);
+    n = httpsSubmitBatch("GET", URLs, count, flags, h, out);
+    if (h != NULL) httpsDelhttpsHeaders(h);
+    for (i = 0; i < count; i++) {
+        httpsReq *r = (httpsReq*)out[i];
+        handles[i] = (r != NULL) ? r->index : -1;
+        if (r == NULL) continue;
+        r->userData = easyNewData(r->index);
+        easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
+    }
+    mem.free(out);
+    return n;
+}
+
+void* easyPrepare(const char *URL, const char *method, const char* *_httpsHeaders, int header_count, bool header_compact,
+                    const char *body, unsigned int bodyBytes) {
+    httpsHeaders *h = NULL;
+    void *t;
+
+    // nothing is sent yet, so threaded or not the template is built right here
+    if ((header_count > 0) && (_httpsHeaders != NULL))
+        h = _easyCreateHeaders(_httpsHeaders, header_count, header_compact);
+    t = httpsPrepare(URL, method, h, body, bodyBytes);
+    if (h != NULL) httpsDelhttpsHeaders(h);
+    return t;
+}
+
+int easyFire(void *prepared, int flags, const char *query, const char *body, unsigned int bodyBytes) {
+    httpsPrepared *t = (httpsPrepared*)prepared;
+    httpsReq *r;
+    easyData *d;
+
+    if (t == NULL) return -1;
+    // are we threaded? the slot holds on to the template until the worker fires it
+    if EASY_THREADED {
+        int slot = easyFreeSlot();
+        if (slot < 0) return slot;
+        easyMessage *m = &_threadStack->slot[slot];
+        easyDataBlock *b = easyMakeDataBlockPass(body, (body != NULL && bodyBytes == 0) ? strlen(body) : bodyBytes, NULL);
+        m->version = 0;
+        m->slot = slot;
+        m->url = memStrdup(t->URL);
+        strcpy(m->message, "FIRE");
+        m->code = flags;
+        m->sz = 0;
+        m->flush = NULL;
+        m->user = NULL;
+        m->data = b;
+        if (b != NULL) {
+            xatomic_add(&t->refs, 1);
+            b->prepared = t;
+            b->query = (query != NULL) ? memStrdup(query) : NULL;
+        }
+        easySubmitSlot(slot);
+        return slot;
+    }
+
+    // the handle isn't known until the request exists, but streamed chunks can arrive before that
+    d = easyNewData(-1);
+    if (flags & HTTPS_STREAM) r = _fire(t, flags, query, body, bodyBytes, easyChunkSink, d);
+        else r = _fire(t, flags, query, body, bodyBytes, NULL, NULL);
+    if (r == NULL) {
+        mem.free(d);
+        return -1;
+    }
+    d->handle = r->index;
+    r->userData = d;
+    easyDeliver(r->index, r->URL, EASY_EVENT_START, r->returnCode, 0, NULL);
     return r->index;
 }
 
 void easyShutdown()
 {
+    if EASY_THREADED {
+        // stop the worker before pulling the requests out from under it
+        _threadStack->quit = true;
+        easyWake();
+        xthread_join(_thread, NULL);
+        con.notify = NULL;
+        easyThreadStack *ps = _threadStack;
+        easyMessage m;
+        _threadStack = NULL;
+        // undelivered streamed bytes are still ours
+        while (easyRingPop(ps->msg, &m)) if (m.event == EASY_EVENT_CHUNK) mem.free(m.data);
+        easyRingFree(ps->msg);
+        easyRingFree(ps->freeSlots);
+        easyRingFree(ps->commands);
+        mem.free(ps->slot);
+        mem.free(ps->slotRelease);
+        mem.free(ps->slotGen);
+        mem.free(ps->slotReq);
+        mem.free(ps->deferred);
+        pthread_cond_destroy(&ps->wake);
+        pthread_mutex_destroy(&ps->wakeLock);
+        mem.free(ps);
+    }
+    // held events that never went out, their streamed bytes are still ours
+    for (int i = 0; i < _eventCount; i++) if (_eventBatch[i].event == EASY_EVENT_CHUNK) mem.free(_eventBatch[i].data);
+    mem.free(_eventBatch);
+    mem.free(_eventGens);
+    _eventBatch = NULL;
+    _eventGens = NULL;
+    _eventCount = 0;
+    _eventCapacity = 0;
     httpsCleanup();
 }
 
@@ -1179,13 +3292,82 @@ void easyShutdown()
 lua_State* lState = NULL;
 int _luaIdLocation = 51;
 
-#define EASY_CB_START       1
-#define EASY_CB_UPDATE      2
-#define EASY_CB_httpsHeaders     3
-#define EASY_CB_LENGTH      4
-#define EASY_CB_MIME        5
-#define EASY_CB_READ        6
-#define EASY_CB_COMPLETE    7
+// method names on a lua callback table and love event names, by EASY_EVENT_*
+static const char *_luaEventMethods[EASY_EVENT_COUNT] = {
+    NULL, "start", "update", "httpsHeaders", "length", "mime", "read", "complete", "chunk"
+};
+static const char *_loveEventNames[EASY_EVENT_COUNT] = {
+    NULL, "start", "update", "headers", "length", "mime", "read", "complete", "chunk"
+};
+// the same strings (msg and love's what) held in the registry, so events don't rehash them
+static int _luaEventNameRefs[EASY_EVENT_COUNT];
+static int _loveEventNameRefs[EASY_EVENT_COUNT];
+
+// what a handle's events need, looked up once when the request is made
+typedef struct _luaHandle {
+    int self;                       // the callback table
+    int url;
+    int fn[EASY_EVENT_COUNT];       // its handler for each event, LUA_NOREF if it has none
+} luaHandle;
+
+luaHandle *_luaHandles = NULL;
+int _luaHandleCount = 0;
+
+static void lua_CacheEventNames(lua_State *L)
+{
+    _luaEventNameRefs[0] = _loveEventNameRefs[0] = LUA_NOREF;
+    for (int e = 1; e < EASY_EVENT_COUNT; e++) {
+        lua_pushstring(L, _easyEventNames[e]);
+        _luaEventNameRefs[e] = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_pushstring(L, _loveEventNames[e]);
+        _loveEventNameRefs[e] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+}
+
+static void lua_UnbindHandle(lua_State *L, int handle)
+{
+    if ((handle < 0) || (handle >= _luaHandleCount)) return;
+    luaHandle *h = &_luaHandles[handle];
+    luaL_unref(L, LUA_REGISTRYINDEX, h->self);
+    luaL_unref(L, LUA_REGISTRYINDEX, h->url);
+    h->self = h->url = LUA_NOREF;
+    for (int e = 0; e < EASY_EVENT_COUNT; e++) {
+        luaL_unref(L, LUA_REGISTRYINDEX, h->fn[e]);
+        h->fn[e] = LUA_NOREF;
+    }
+}
+
+// remember the callback table at stack index cb, its handlers and the url at index url for a new handle,
+// handlers added to the table after this are not seen
+static void lua_BindHandle(lua_State *L, int handle, int cb, int url)
+{
+    if (handle < 0) return;
+    if (handle >= _luaHandleCount) {
+        int grow = (_luaHandleCount > 0) ? _luaHandleCount * 2 : 64;
+        while (grow <= handle) grow *= 2;
+        luaHandle *grown = mem.realloc(_luaHandles, sizeof(luaHandle) * grow);
+        if (grown == NULL) luaL_error(L, "https is out of memory for request %d", handle);
+        for (int i = _luaHandleCount; i < grow; i++) {
+            grown[i].self = grown[i].url = LUA_NOREF;
+            for (int e = 0; e < EASY_EVENT_COUNT; e++) grown[i].fn[e] = LUA_NOREF;
+        }
+        _luaHandles = grown;
+        _luaHandleCount = grow;
+    }
+    // a reused handle drops whatever its last request left behind
+    lua_UnbindHandle(L, handle);
+    if (!lua_istable(L, cb)) return;
+    luaHandle *h = &_luaHandles[handle];
+    for (int e = 1; e < EASY_EVENT_COUNT; e++) {
+        lua_getfield(L, cb, _luaEventMethods[e]);
+        if (lua_isfunction(L, -1)) h->fn[e] = luaL_ref(L, LUA_REGISTRYINDEX);
+            else lua_pop(L, 1);
+    }
+    lua_pushvalue(L, cb);
+    h->self = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, url);
+    h->url = luaL_ref(L, LUA_REGISTRYINDEX);
+}
 
 void lua_getregtable(lua_State *L) {
     lua_pushlightuserdata(L, &_luaIdLocation);
@@ -1209,45 +3391,56 @@ int lua_ReadHeader(lua_State* L)
     return 1;
 }
 
-void lua_Callback(int handle, const char* url, const char* msg, int code, unsigned int sz, void* data)
+// the data argument of an event for the lua callbacks
+static void lua_PushEventData(lua_State *L, const easyEvent *e)
 {
-    int t = lua_gettop(lState);
-    int cbm = 0;
-    lua_getregtable(lState);
-    lua_rawgeti (lState, -1, handle);
-    if (lua_istable(lState,-1)) {
-        // find the callback in the 
-        if (!strcmp(msg,"START")) { lua_pushliteral(lState,"start"); cbm = EASY_CB_START; }
-         else if (!strcmp(msg,"UPDATE")) { lua_pushliteral(lState,"update"); cbm = EASY_CB_UPDATE; }
-         else if (!strcmp(msg,"httpsHeaders")) { lua_pushliteral(lState,"httpsHeaders"); cbm = EASY_CB_httpsHeaders; }
-         else if (!strcmp(msg,"LENGTH")) { lua_pushliteral(lState,"length"); cbm = EASY_CB_LENGTH; }
-         else if (!strcmp(msg,"MIME")) { lua_pushliteral(lState,"mime"); cbm = EASY_CB_MIME; }
-         else if (!strcmp(msg,"READ")) { lua_pushliteral(lState,"read"); cbm = EASY_CB_READ; }
-         else if (!strcmp(msg,"COMPLETE")) { lua_pushliteral(lState,"complete"); cbm = EASY_CB_COMPLETE; }
-         else lua_pushliteral(lState,"nope");
-         lua_gettable(lState, -2);
-         if (lua_isfunction(lState, -1)) {
-            lua_pushvalue(lState, -2);  // push self for the :() calling convention
-            lua_pushinteger(lState, handle);
-            lua_pushstring(lState, url);
-            lua_pushstring(lState, msg);
-            lua_pushinteger(lState, code);
-            lua_pushinteger(lState, sz);
-            if (data) {
-                if (cbm == EASY_CB_MIME) lua_pushstring(lState, (char*)data);
-                if (cbm == EASY_CB_httpsHeaders) {
-                    lua_pushinteger(lState, handle);
-                    lua_pushlightuserdata(lState, data);
-                    lua_pushcclosure(lState, lua_ReadHeader, 2);
-                }
-                if (cbm == EASY_CB_COMPLETE) {
-                    lua_pushlightuserdata(lState, data);
-                }
-            } else lua_pushnil(lState);
+    if (e->data == NULL) {
+        lua_pushnil(L);
+        return;
+    }
+    switch (e->event) {
+        case EASY_EVENT_MIME:
+            lua_pushstring(L, (char*)e->data);
+            break;
+        case EASY_EVENT_HEADERS:
+            lua_pushinteger(L, e->handle);
+            lua_pushlightuserdata(L, e->data);
+            lua_pushcclosure(L, lua_ReadHeader, 2);
+            break;
+        case EASY_EVENT_COMPLETE:
+            lua_pushlightuserdata(L, e->data);
+            break;
+        case EASY_EVENT_CHUNK:
+            lua_pushlstring(L, (const char*)e->data, e->sz);
+            break;
+        default:
+            lua_pushnil(L);
+    }
+}
+
+// everything since the last update in one go, each handler was found when its request was made
+void lua_Events(const easyEvent *events, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const easyEvent *e = &events[i];
+        if ((e->event <= 0) || (e->event >= EASY_EVENT_COUNT)) continue;
+        if ((e->handle < 0) || (e->handle >= _luaHandleCount)) continue;
+        // the handle table can move if a handler makes a request, so no pointer is kept over the call
+        int fn = _luaHandles[e->handle].fn[e->event];
+        if (fn != LUA_NOREF) {
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, fn);
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, _luaHandles[e->handle].self);  // self for the :() calling convention
+            lua_pushinteger(lState, e->handle);
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, _luaHandles[e->handle].url);
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, _luaEventNameRefs[e->event]);
+            lua_pushinteger(lState, e->code);
+            lua_pushinteger(lState, e->sz);
+            lua_PushEventData(lState, e);
             lua_call(lState, 7, 0);
-         }
+        }
+        // nothing follows a complete, let go of the callback table
+        if (e->event == EASY_EVENT_COMPLETE) lua_UnbindHandle(lState, e->handle);
     }
-    lua_settop(lState, t);
 }
 
 /*
@@ -1262,41 +3455,29 @@ void lua_Callback(int handle, const char* url, const char* msg, int code, unsign
         'mime' - content mime type was determined
         'read' - a single read event finished (might need multiple to complete)
         'complete' - the request has been completed (ok or error)
+        'chunk' - part of a streamed body, data is a string holding just those bytes
 */
-void luaLove_Callback(int handle, const char* url, const char* msg, int code, unsigned int sz, void* data)
+void luaLove_Events(const easyEvent *events, int count)
 {
     int t = lua_gettop(lState);
-    int cbm = 0;
     lua_getfield(lState, LUA_GLOBALSINDEX, "love");
     lua_getfield(lState, -1, "handlers");
     lua_getfield(lState, -1, "https");
-    if (lua_isfunction(lState,-1)) {
-        // find the callback in the 
-        if (!strcmp(msg,"START")) { lua_pushliteral(lState,"start"); cbm = EASY_CB_START; }
-         else if (!strcmp(msg,"UPDATE")) { lua_pushliteral(lState,"update"); cbm = EASY_CB_UPDATE; }
-         else if (!strcmp(msg,"HEADERS")) { lua_pushliteral(lState,"headers"); cbm = EASY_CB_httpsHeaders; }
-         else if (!strcmp(msg,"LENGTH")) { lua_pushliteral(lState,"length"); cbm = EASY_CB_LENGTH; }
-         else if (!strcmp(msg,"MIME")) { lua_pushliteral(lState,"mime"); cbm = EASY_CB_MIME; }
-         else if (!strcmp(msg,"READ")) { lua_pushliteral(lState,"read"); cbm = EASY_CB_READ; }
-         else if (!strcmp(msg,"COMPLETE")) { lua_pushliteral(lState,"complete"); cbm = EASY_CB_COMPLETE; }
-         else lua_pushliteral(lState,"nope");
-        lua_pushinteger(lState, handle);
-        lua_pushstring(lState, url);
-        lua_pushstring(lState, msg);
-        lua_pushinteger(lState, code);
-        lua_pushinteger(lState, sz);
-        if (data) {
-            if (cbm == EASY_CB_MIME) lua_pushstring(lState, (char*)data);
-            if (cbm == EASY_CB_httpsHeaders) {
-                lua_pushinteger(lState, handle);
-                lua_pushlightuserdata(lState, data);
-                lua_pushcclosure(lState, lua_ReadHeader, 2);
-            }
-            if (cbm == EASY_CB_COMPLETE) {
-                lua_pushlightuserdata(lState, data);
-            }
-        } else lua_pushnil(lState);
-        lua_call(lState, 7, 0);
+    if (lua_isfunction(lState, -1)) {
+        for (int i = 0; i < count; i++) {
+            const easyEvent *e = &events[i];
+            if ((e->event <= 0) || (e->event >= EASY_EVENT_COUNT)) continue;
+            lua_pushvalue(lState, t + 3);
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, _loveEventNameRefs[e->event]);
+            lua_pushinteger(lState, e->handle);
+            lua_pushstring(lState, e->url);
+            lua_rawgeti(lState, LUA_REGISTRYINDEX, _luaEventNameRefs[e->event]);
+            lua_pushinteger(lState, e->code);
+            lua_pushinteger(lState, e->sz);
+            lua_PushEventData(lState, e);
+            lua_call(lState, 7, 0);
+            if (e->event == EASY_EVENT_COMPLETE) lua_UnbindHandle(lState, e->handle);
+        }
     }
     lua_settop(lState, t);
 }
@@ -1309,12 +3490,7 @@ void luaLove_Callback(int handle, const char* url, const char* msg, int code, un
     will delay that many seconds before returning
 */
 int lua_Update(lua_State* L) {
-    // are we threaded? poll the messages
-    if EASY_THREADED {
-        // TODO
-        return 0;
-    }
-    // pass the call down
+    // pass the call down (threaded, this just delivers what the worker posted)
     lua_getregtable(L);
     lua_assert_init(L);
     easyUpdate();
@@ -1322,7 +3498,7 @@ int lua_Update(lua_State* L) {
 }
 
 /* 
-    https.get(url, callback, httpsHeaders)
+    https.get(url, callback, httpsHeaders, opts)
 
         url is a string with the url to be requested using http get.
 
@@ -1331,13 +3507,69 @@ int lua_Update(lua_State* L) {
 
         httpsHeaders is an optional table of httpsHeaders to pass to this request
             the string:string keys/values of the table only are sent as http httpsHeaders
+
+        https.options("EASY_OPT_FLAGS", 2) keeps the body as pooled chunks instead of one growing buffer,
+            walk it with https.chunks(handle), https.body() still works (flattening it once complete)
+
+        if callback has a chunk function the body is streamed instead of buffered,
+            callback:chunk(handle, url, msg, bytes, bytes, data) gets each new piece as a string
+            and complete no longer carries the body
+
+        opts is an optional table, for when more is asked for than EASY_OPT_ACTIVE lets run at once:
+            priority = "interactive" (the default) or "background", background waits behind interactive requests
+                until its deadline (30 seconds if none is given) has passed
+            deadline = seconds it should start within, earliest deadline goes first
+            events = { "read", "complete", ... } only these events, complete always comes
+                (without it, only the events callback has a function for)
+            progressBytes = bytes, read at most once per this many bytes
+            progressSeconds = seconds, read at most once per this often (the last read comes either way)
+
+        returns the handle, or -1 if the request could not be made at all
 */
 int lua_Get(lua_State* L) {
     const char *head[MAX_HEADERS*2];
     int i = 0;
     int r = 0;
+    int flags = EASY_CHUNKED ? HTTPS_CHUNK_BUFFER : 0;
+    easyRequestOptions opts;
+    memset(&opts, 0, sizeof(easyRequestOptions));
     const char *url = luaL_checklstring(L, 1, NULL);
     luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "chunk");
+    if (lua_isfunction(L, -1)) flags |= HTTPS_STREAM;
+    lua_pop(L, 1);
+    // nothing calls into lua for an event the callback has no function for (love gets them all)
+    if (!libhttpsLove) {
+        for (int e = 1; e < EASY_EVENT_COUNT; e++) {
+            lua_getfield(L, 2, _luaEventMethods[e]);
+            if (lua_isfunction(L, -1)) opts.events |= EASY_EVENT_MASK(e);
+            lua_pop(L, 1);
+        }
+        opts.events |= EASY_EVENT_MASK(EASY_EVENT_COMPLETE);
+    }
+    if (lua_istable(L, 4)) {
+        lua_getfield(L, 4, "priority");
+        if (lua_isstring(L, -1) && !strcmp(lua_tostring(L, -1), "background")) flags |= HTTPS_BACKGROUND;
+        lua_getfield(L, 4, "deadline");
+        if (lua_isnumber(L, -1)) opts.deadline = lua_tonumber(L, -1);
+        lua_getfield(L, 4, "progressBytes");
+        if (lua_isnumber(L, -1)) opts.progressBytes = lua_tointeger(L, -1);
+        lua_getfield(L, 4, "progressSeconds");
+        if (lua_isnumber(L, -1)) opts.progressSeconds = lua_tonumber(L, -1);
+        lua_getfield(L, 4, "events");
+        if (lua_istable(L, -1)) {
+            unsigned int wanted = EASY_EVENT_MASK(EASY_EVENT_COMPLETE);
+            for (int k = 1; k <= (int)lua_objlen(L, -1); k++) {
+                lua_rawgeti(L, -1, k);
+                const char *name = lua_tostring(L, -1);
+                for (int e = 1; (name != NULL) && (e < EASY_EVENT_COUNT); e++)
+                    if (!strcmp(name, _luaEventMethods[e]) || !strcmp(name, _loveEventNames[e])) wanted |= EASY_EVENT_MASK(e);
+                lua_pop(L, 1);
+            }
+            opts.events = libhttpsLove ? wanted : (opts.events & wanted);
+        }
+        lua_pop(L, 5);
+    }
     if (lua_istable(L, 3)) {
         // scan the table for string pairs, ignoring everything else
         lua_pushnil(L);
@@ -1349,14 +3581,18 @@ int lua_Get(lua_State* L) {
             }
             lua_pop(L, 1);
         }
-        r = easyGet(url, 0, head, i, false);
+        r = easyGetWith(url, flags, head, i, false, &opts);
     } else {
-        r = easyGet(url, 0, NULL, 0, false);
+        r = easyGetWith(url, flags, NULL, 0, false, &opts);
     }
     lua_getregtable(L);
     lua_assert_init(L);
-    lua_pushvalue(L, 2);
-    lua_rawseti(L, -2, r);
+    if (r < 0) {
+        lua_settop(L, 4);
+        lua_pushinteger(L, r);
+        return 1;
+    }
+    lua_BindHandle(L, r, 2, 1);
     // see if the callback has a table called handle and if it does, add this handle to it
     lua_getfield(L, 2, "handle");
     if (lua_istable(L, -1)) {
@@ -1407,8 +3643,7 @@ int lua_GetFile(lua_State* L) {
     }
     lua_getregtable(L);
     lua_assert_init(L);
-    lua_pushvalue(L, 2);
-    lua_rawseti(L, -2, r);
+    lua_BindHandle(L, r, 2, 1);
     // see if the callback has a table called handle and if it does, add this handle to it
     lua_getfield(L, 2, "handle");
     if (lua_istable(L, -1)) {
@@ -1438,6 +3673,7 @@ int lua_Post(lua_State* L) {
     const char *head[MAX_HEADERS*2];
     int i = 0;
     int r = 0;
+    int flags = EASY_CHUNKED ? HTTPS_CHUNK_BUFFER : 0;
     const char *url = luaL_checklstring (L, 1, NULL);
     size_t bbytes;
     const char *body = luaL_checklstring (L, 2, &bbytes);
@@ -1453,14 +3689,13 @@ int lua_Post(lua_State* L) {
             }
             lua_pop(L, 1);
         }
-        r = easyPost(url, 0, body, bbytes, head, i, false);
+        r = easyPost(url, flags, body, bbytes, head, i, false);
     } else {
-        r = easyPost(url, 0, body, bbytes, NULL, 0, false);
+        r = easyPost(url, flags, body, bbytes, NULL, 0, false);
     }
     lua_getregtable(L);
     lua_assert_init(L);
-    lua_pushvalue(L, 2);
-    lua_rawseti(L, -2, r);
+    lua_BindHandle(L, r, 2, 1);
     // see if the callback has a table called handle and if it does, add this handle to it
     lua_getfield(L, 2, "handle");
     if (lua_istable(L, -1)) {
@@ -1507,8 +3742,7 @@ int lua_Head(lua_State* L) {
     }
     lua_getregtable(L);
     lua_assert_init(L);
-    lua_pushvalue(L, 2);
-    lua_rawseti(L, -2, r);
+    lua_BindHandle(L, r, 2, 1);
     // see if the callback has a table called handle and if it does, add this handle to it
     lua_getfield(L, 2, "handle");
     if (lua_istable(L, -1)) {
@@ -1521,6 +3755,210 @@ int lua_Head(lua_State* L) {
     return 1;
 }
 
+/* 
+    https.getMany(urls, callbacks, httpsHeaders)
+
+    urls is an array of url strings to be requested using http get, all started together
+        (far cheaper than a get per url when loading a pile of assets at once).
+
+    callbacks is either one callback table for every request, or an array of them that lines up with urls.
+
+    httpsHeaders is an optional table of httpsHeaders sent with every request
+        the string:string keys/values of the table only are sent as http httpsHeaders
+
+    returns an array of handles lined up with urls, -1 where a request could not be started,
+    bodies are buffered (no chunk streaming here)
+*/
+int lua_GetMany(lua_State* L) {
+    const char *head[MAX_HEADERS*2];
+    int i = 0, n, k;
+    int flags = EASY_CHUNKED ? HTTPS_CHUNK_BUFFER : 0;
+    bool each;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    n = lua_objlen(L, 1);
+    lua_rawgeti(L, 2, 1);
+    each = lua_istable(L, -1);
+    lua_pop(L, 1);
+    if (lua_istable(L, 3)) {
+        // scan the table for string pairs, ignoring everything else
+        lua_pushnil(L);
+        while ((lua_next(L, 3) != 0) && (i < MAX_HEADERS)) {
+            if (lua_isstring(L, -2) && lua_isstring(L, -1)) {
+                head[i*2] = lua_tolstring(L, -2, NULL);
+                head[i*2+1] = lua_tolstring(L, -1, NULL);
+                i++;
+            }
+            lua_pop(L, 1);
+        }
+    }
+    lua_settop(L, 3);
+    lua_getregtable(L);
+    lua_assert_init(L);
+    lua_createtable(L, n, 0);
+    if (n == 0) return 1;
+    // the url strings stay put while the table that holds them is on the stack
+    const char **urls = mem.malloc((sizeof(const char*) + sizeof(int)) * n);
+    if (urls == NULL) luaL_error(L, "https.getMany() is out of memory");
+    int *handles = (int*)(urls + n);
+    for (k = 0; k < n; k++) {
+        lua_rawgeti(L, 1, k + 1);
+        urls[k] = (lua_type(L, -1) == LUA_TSTRING) ? lua_tolstring(L, -1, NULL) : NULL;
+        lua_pop(L, 1);
+    }
+    easyGetMany(urls, n, flags, head, i, false, handles);
+    mem.free(urls);
+    for (k = 0; k < n; k++) {
+        int r = handles[k];
+        lua_pushinteger(L, r);
+        lua_rawseti(L, 5, k + 1);
+        if (r < 0) continue;
+        // the callback table for this one
+        if (each) lua_rawgeti(L, 2, k + 1);
+            else lua_pushvalue(L, 2);
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            continue;
+        }
+        lua_rawgeti(L, 1, k + 1);
+        lua_BindHandle(L, r, lua_gettop(L) - 1, lua_gettop(L));
+        lua_pop(L, 1);
+        // see if the callback has a table called handle and if it does, add this handle to it
+        lua_getfield(L, -1, "handle");
+        if (lua_istable(L, -1)) {
+            lua_pushinteger(L, r);
+            lua_rawgeti(L, 1, k + 1);
+            lua_settable(L, -3);
+        }
+        lua_pop(L, 2);
+    }
+    return 1;
+}
+
+#define LUA_PREPARED_META   "https.prepared"
+
+static int lua_PreparedGC(lua_State* L) {
+    void **t = (void**)luaL_checkudata(L, 1, LUA_PREPARED_META);
+    httpsUnprepare(*t);
+    *t = NULL;
+    return 0;
+}
+
+/* 
+    https.prepare(url, httpsHeaders, opts)
+
+    url is a string with the url to be requested, checked once here (nil is returned if it isn't http or https).
+
+    httpsHeaders is an optional table of httpsHeaders sent with every request fired from this
+        the string:string keys/values of the table only are sent as http httpsHeaders
+
+    opts is an optional table:
+        method = "GET" (the default), "POST" or "HEAD"
+        body = a string sent with every request unless the fire brings its own
+
+    returns a prepared request for https.fire(), for endpoints that are polled over and over,
+    it is freed when collected (requests still running keep what they need)
+*/
+int lua_Prepare(lua_State* L) {
+    const char *head[MAX_HEADERS*2];
+    int i = 0;
+    const char *url = luaL_checklstring(L, 1, NULL);
+    const char *method = NULL;
+    const char *body = NULL;
+    size_t bbytes = 0;
+    void *t;
+    if (lua_istable(L, 2)) {
+        // scan the table for string pairs, ignoring everything else
+        lua_pushnil(L);
+        while ((lua_next(L, 2) != 0) && (i < MAX_HEADERS)) {
+            if (lua_isstring(L, -2) && lua_isstring(L, -1)) {
+                head[i*2] = lua_tolstring(L, -2, NULL);
+                head[i*2+1] = lua_tolstring(L, -1, NULL);
+                i++;
+            }
+            lua_pop(L, 1);
+        }
+    }
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "method");
+        if (lua_isstring(L, -1)) method = lua_tolstring(L, -1, NULL);
+        lua_getfield(L, 3, "body");
+        if (lua_isstring(L, -1)) body = lua_tolstring(L, -1, &bbytes);
+    }
+    lua_getregtable(L);
+    lua_assert_init(L);
+    lua_pop(L, 1);
+    t = easyPrepare(url, method, head, i, false, body, bbytes);
+    lua_settop(L, 3);
+    if (t == NULL) {
+        lua_pushnil(L);
+        return 1;
+    }
+    void **ud = (void**)lua_newuserdata(L, sizeof(void*));
+    *ud = t;
+    if (luaL_newmetatable(L, LUA_PREPARED_META)) {
+        lua_pushcfunction(L, lua_PreparedGC);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+/* 
+    https.fire(prepared, callback, opts)
+
+    prepared is what https.prepare() returned.
+
+    callback is a table object which gets callbacks from this request, as so:
+        callback:name(vars)
+        if callback has a chunk function the body is streamed, the same as https.get()
+
+    opts is an optional table:
+        query = a string added to the url (after a ? or &)
+        body = a string sent instead of the prepared body
+
+    returns the handle of the new request
+*/
+int lua_Fire(lua_State* L) {
+    int r = 0;
+    int flags = EASY_CHUNKED ? HTTPS_CHUNK_BUFFER : 0;
+    void **t = (void**)luaL_checkudata(L, 1, LUA_PREPARED_META);
+    const char *query = NULL;
+    const char *body = NULL;
+    size_t bbytes = 0;
+    if (*t == NULL) luaL_error(L, "https.fire() called with a prepared request that was already freed");
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "chunk");
+    if (lua_isfunction(L, -1)) flags |= HTTPS_STREAM;
+    lua_pop(L, 1);
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "query");
+        if (lua_isstring(L, -1)) query = lua_tolstring(L, -1, NULL);
+        lua_getfield(L, 3, "body");
+        if (lua_isstring(L, -1)) body = lua_tolstring(L, -1, &bbytes);
+    }
+    r = easyFire(*t, flags, query, body, bbytes);
+    lua_getregtable(L);
+    lua_assert_init(L);
+    lua_settop(L, 3);
+    // the url actually requested, the query goes on the way _fire() puts it there (query still lives in opts)
+    const char *base = ((httpsPrepared*)*t)->URL;
+    if ((query != NULL) && (*query != 0))
+        lua_pushfstring(L, "%s%c%s", base, (strchr(base, '?') != NULL) ? '&' : '?', query);
+    else lua_pushstring(L, base);
+    lua_BindHandle(L, r, 2, 4);
+    // see if the callback has a table called handle and if it does, add this handle to it
+    lua_getfield(L, 2, "handle");
+    if (lua_istable(L, -1)) {
+        lua_pushinteger(L, r);
+        lua_pushvalue(L, 4);
+        lua_settable(L, -3);
+    }
+    lua_settop(L, 3);
+    lua_pushinteger(L, r);
+    return 1;
+}
+
 /* 
     called to initialize the system, must be done for any other calls into https
 
@@ -1537,7 +3975,7 @@ int lua_Head(lua_State* L) {
 
         msg is the msq que depth
 
-        slot is the slot que depth
+        slot is how many handles to make room for up front, more are added as they run out
 */
 int lua_Init(lua_State* L) {
     int arg2 = 0;
@@ -1545,10 +3983,11 @@ int lua_Init(lua_State* L) {
     if (lua_isnumber (L, 2)) arg2 = lua_tointeger(L, 2);
     if (lua_isnumber (L, 3)) arg3 = lua_tointeger(L, 3);
     if (lua_toboolean(L, 1) > 0) {
-        easySetupThreaded(lua_Callback, arg2, arg3);
+        easySetupThreaded(NULL, arg2, arg3);
     } else {
-        easySetup(lua_Callback, arg2);
+        easySetup(NULL, arg2);
     }
+    easySetEventCallback(lua_Events, true);
     lua_getregtable(L);
     lua_pushinteger(L, 2422422);
     lua_rawseti(L, -2, 1421421);
@@ -1563,6 +4002,10 @@ int lua_Init(lua_State* L) {
 */
 int lua_Shutdown(lua_State *L) {
     easyShutdown();
+    for (int i = 0; i < _luaHandleCount; i++) lua_UnbindHandle(L, i);
+    mem.free(_luaHandles);
+    _luaHandles = NULL;
+    _luaHandleCount = 0;
     return 0;
 }
 
@@ -1575,8 +4018,9 @@ int lua_Shutdown(lua_State *L) {
 */
 int lua_Response(lua_State *L) {
     int i = luaL_checkinteger(L, 1);
-    if ((i < 0) || (i >= MAX_REQUEST)) luaL_error(L, "https.response() attempt to index a request %d, outside range 0 - %d", i, MAX_REQUEST);
-    lua_pushinteger(L, httpsGetCodeI(i));
+    httpsReq *r = _easyReq(i);
+    if (r == NULL) luaL_error(L, "https.response() attempt to index a request %d that is not live", i);
+    lua_pushinteger(L, httpsGetCodeI(r->index));
     return 1;
 }
 
@@ -1586,6 +4030,20 @@ int lua_Response(lua_State *L) {
     name is the name of the option to set.
 
     value can be an integer, double, or string (as needed by the option)
+
+        EASY_OPT_BACKEND "poll" or "epoll", the linux transfer loop, call before https.init()
+        EASY_OPT_WORKERS number of linux transfer threads (0 for one per processor), call before https.init()
+        EASY_OPT_REQUESTS request slots to reserve, the table still grows on demand past this
+        EASY_OPT_HANDLES idle curl handles kept per linux transfer thread (0 default, -1 none), call before https.init()
+        EASY_OPT_DNS_TTL seconds resolved hosts stay in the shared dns cache (0 default, -1 forever), call before requests
+        EASY_OPT_CONNECTIONS idle connections kept open per linux transfer thread (0 default), call before https.init()
+        EASY_OPT_HTTP "default", "http1", "h2" (multiplexed over tls) or "h2c" (prior knowledge, plain http), call before https.init()
+        EASY_OPT_STREAMS h2 streams multiplexed per connection (0 default), call before https.init()
+        EASY_OPT_HOST_CONNECTIONS connections per host (0 unlimited), call before https.init()
+        EASY_OPT_TOTAL_CONNECTIONS connections per linux transfer thread (0 unlimited), call before https.init()
+        EASY_OPT_STREAM_WEIGHT h2 stream weight 1-256 given to requests (0 default)
+        EASY_OPT_ACTIVE transfers running at once (256 default, 0 unlimited), requests past it wait their turn
+        EASY_OPT_HOST_ACTIVE transfers running at once per host (0 unlimited)
 */
 int lua_Options(lua_State* L) {
     const char *n = luaL_checklstring (L, 1, NULL);
@@ -1593,6 +4051,44 @@ int lua_Options(lua_State* L) {
         easyOptionUI(EASY_OPT_FLAGS, luaL_checkinteger(L, 2));
     } else if (!strcmp(n, "EASY_OPT_DELAY")) {
         easyOptionD(EASY_OPT_DELAY, luaL_checknumber(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_BACKEND")) {
+        if (lua_type(L, 2) == LUA_TSTRING) {
+            const char *v = lua_tostring(L, 2);
+            if (!strcmp(v, "epoll")) easyOptionUI(EASY_OPT_BACKEND, naettBackendEpoll);
+            else if (!strcmp(v, "poll")) easyOptionUI(EASY_OPT_BACKEND, naettBackendPoll);
+            else luaL_error(L, "Unsupported EASY_OPT_BACKEND value: %s", v);
+        } else easyOptionUI(EASY_OPT_BACKEND, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_WORKERS")) {
+        easyOptionUI(EASY_OPT_WORKERS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_REQUESTS")) {
+        easyOptionUI(EASY_OPT_REQUESTS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_HANDLES")) {
+        easyOptionD(EASY_OPT_HANDLES, luaL_checknumber(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_DNS_TTL")) {
+        easyOptionD(EASY_OPT_DNS_TTL, luaL_checknumber(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_CONNECTIONS")) {
+        easyOptionUI(EASY_OPT_CONNECTIONS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_HTTP")) {
+        if (lua_type(L, 2) == LUA_TSTRING) {
+            const char *v = lua_tostring(L, 2);
+            if (!strcmp(v, "default")) easyOptionUI(EASY_OPT_HTTP, naettHTTPDefault);
+            else if (!strcmp(v, "http1")) easyOptionUI(EASY_OPT_HTTP, naettHTTP1);
+            else if (!strcmp(v, "h2")) easyOptionUI(EASY_OPT_HTTP, naettHTTP2);
+            else if (!strcmp(v, "h2c")) easyOptionUI(EASY_OPT_HTTP, naettHTTP2PriorKnowledge);
+            else luaL_error(L, "Unsupported EASY_OPT_HTTP value: %s", v);
+        } else easyOptionUI(EASY_OPT_HTTP, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_STREAMS")) {
+        easyOptionUI(EASY_OPT_STREAMS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_HOST_CONNECTIONS")) {
+        easyOptionUI(EASY_OPT_HOST_CONNECTIONS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_TOTAL_CONNECTIONS")) {
+        easyOptionUI(EASY_OPT_TOTAL_CONNECTIONS, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_STREAM_WEIGHT")) {
+        easyOptionUI(EASY_OPT_STREAM_WEIGHT, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_ACTIVE")) {
+        easyOptionUI(EASY_OPT_ACTIVE, luaL_checkinteger(L, 2));
+    } else if (!strcmp(n, "EASY_OPT_HOST_ACTIVE")) {
+        easyOptionUI(EASY_OPT_HOST_ACTIVE, luaL_checkinteger(L, 2));
     } else {
         luaL_error(L, "Unsupported option name: %s", n);    
     }
@@ -1607,7 +4103,7 @@ int lua_Options(lua_State* L) {
 
         url = url of the request
         mime = mime content type of the request
-        start = time the request began
+        start = time the request began, in seconds on a monotonic clock (compare it with other starts, not os.time())
         rate = bytes per second
         bytes = bytes read so far
         totalbytes = total bytes to read
@@ -1621,13 +4117,8 @@ int lua_Options(lua_State* L) {
 */
 int lua_Metrics(lua_State* L) {
     // find if we have any metrics
-    int h = -1;
-    int s = luaL_checkinteger(L, 1);
-    for (int i = 0; i < MAX_REQUEST; i++) {
-        h = easyGetMetricI(i, EASY_METRIC_HANDLE);
-        if (h == s) break;
-    }
-    if (h == -1) {
+    int h = luaL_checkinteger(L, 1);
+    if (!easyHasMetrics(h)) {
         // not found, return false
         lua_pushboolean(L, 0);
         return 1;
@@ -1665,9 +4156,10 @@ int lua_HeaderLister(const char* name, const char* value, void* r)
 */
 int lua_List(lua_State* L) {
     int h = luaL_checkinteger(L, 1);
-    if ((h < 0) || (h >= MAX_REQUEST)) luaL_error(L, "https.list() called with out of range value %d", h);
+    httpsReq *r = _easyReq(h);
+    if (r == NULL) luaL_error(L, "https.list() called with a handle that is not live %d", h);
     lua_newtable(L);
-    httpsListhttpsHeaders(con.requestTable[h], lua_HeaderLister);
+    httpsListhttpsHeaders(r, lua_HeaderLister);
     return 1;
 }
 
@@ -1686,15 +4178,91 @@ int lua_List(lua_State* L) {
 int lua_Body(lua_State* L) {
     int h = luaL_checkinteger(L, 1);
     unsigned int start, end;
-    if ((h < 0) || (h >= MAX_REQUEST)) luaL_error(L, "https.body() called with out of range value %d", h);
-    httpsReq *r = con.requestTable[h];
+    httpsReq *r = _easyReq(h);
+    if (r == NULL) luaL_error(L, "https.body() called with a handle that is not live %d", h);
+    // a complete chunked body is flattened the first time somebody wants it whole
+    bool chunked = !httpsFlattenBody(r);
     if (lua_isnumber(L, 2)) start = lua_tointeger(L, 2);
         else start = 0;
     if (lua_isnumber(L, 3)) end = lua_tointeger(L, 3);
-        else end = r->buffer.end;
+        else end = chunked ? httpsGetBodyLength(r) : r->buffer.end;
     if (start < 1) start = 1;
     if (end < start) lua_pushstring(L, "");
-        else lua_pushlstring(L, (const char*)r->buffer.data + start - 1, end - start + 1);
+    else if (chunked) {
+        // still arriving, so gather the slice from the chunks
+        luaL_Buffer b;
+        unsigned int at = 1;
+        int n = httpsGetBodyChunks(r, NULL, 0);
+        httpsIovec *iov = mem.malloc(sizeof(httpsIovec) * (n + 1));
+        if (iov == NULL) luaL_error(L, "https.body() out of memory");
+        // anything that arrives after counting waits for the next call
+        httpsGetBodyChunks(r, iov, n);
+        luaL_buffinit(L, &b);
+        for (int i = 0; (i < n) && (at <= end); i++) {
+            unsigned int from = (start > at) ? start - at : 0;
+            unsigned int to = (end < at + iov[i].len - 1) ? end - at + 1 : iov[i].len;
+            if (from < to) luaL_addlstring(&b, (const char*)iov[i].base + from, to - from);
+            at += iov[i].len;
+        }
+        mem.free(iov);
+        luaL_pushresult(&b);
+    } else lua_pushlstring(L, (const char*)r->buffer.data + start - 1, end - start + 1);
+    return 1;
+}
+
+static int lua_ChunkNext(lua_State* L) {
+    int h = lua_tointeger(L, lua_upvalueindex(1));
+    httpsChunk *c = (httpsChunk*)lua_touserdata(L, lua_upvalueindex(2));
+    bool started = lua_toboolean(L, lua_upvalueindex(3));
+    lua_Number seq = lua_tonumber(L, lua_upvalueindex(4));
+    httpsReq *r = _easyReq(h);
+    const void *data = NULL;
+    unsigned int len = 0;
+    if (r == NULL) return 0;
+    // released and the handle reused since the last call, c belongs to someone else now
+    if ((lua_Number)r->seq != seq) return 0;
+    if (!(r->flags & HTTPS_CHUNK_BUFFER)) {
+        // contiguous (or flattened before we started), the whole thing is one piece
+        if (started || (c != NULL)) return 0;
+        data = r->buffer.data;
+        len = r->buffer.end;
+    } else {
+        _ENTER_REQ(r)
+        c = started ? c->next : r->chunkHead;
+        if (c != NULL) {
+            data = c->data;
+            len = c->end;
+        }
+        _EXIT_REQ(r)
+        if (c == NULL) return 0;
+        lua_pushlightuserdata(L, c);
+        lua_replace(L, lua_upvalueindex(2));
+    }
+    lua_pushboolean(L, 1);
+    lua_replace(L, lua_upvalueindex(3));
+    lua_pushlstring(L, (const char*)data, len);
+    return 1;
+}
+
+/* 
+    https.chunks(handle)
+
+    handle integer of the request
+
+    returns an iterator over the body one stored chunk at a time, without flattening it
+    (a body that isn't chunked comes out as a single piece), walk it once complete to see it all
+        for piece in https.chunks(handle) do ... end
+*/
+int lua_Chunks(lua_State* L) {
+    int h = luaL_checkinteger(L, 1);
+    httpsReq *r = _easyReq(h);
+    if (r == NULL) luaL_error(L, "https.chunks() called with a handle that is not live %d", h);
+    lua_pushinteger(L, h);
+    lua_pushlightuserdata(L, NULL);
+    lua_pushboolean(L, 0);
+    // which request the handle meant when the iterator was made, see _admitMany()
+    lua_pushnumber(L, (lua_Number)r->seq);
+    lua_pushcclosure(L, lua_ChunkNext, 4);
     return 1;
 }
 
@@ -1707,8 +4275,11 @@ int lua_Body(lua_State* L) {
 */
 int lua_Release(lua_State* L) {
     int h = luaL_checkinteger(L, 1);
-    if ((h < 0) || (h >= MAX_REQUEST)) luaL_error(L, "https.release() called with out of range value %d", h);
-    httpsFinished(con.requestTable[h]);
+    httpsReq *r = _easyReq(h);
+    if (r == NULL) luaL_error(L, "https.release() called with a handle that is not live %d", h);
+    easyRelease(h);
+    // a released handle may never see its complete, so its callback table is let go here
+    lua_UnbindHandle(L, h);
     return 0;
 }
 
@@ -1721,8 +4292,8 @@ int lua_Release(lua_State* L) {
 */
 int lua_Memio(lua_State* L) {
     int h = luaL_checkinteger(L, 1);
-    if ((h < 0) || (h >= MAX_REQUEST)) luaL_error(L, "https.memio() called with out of range value %d", h);
-    httpsReq *r = con.requestTable[h];
+    httpsReq *r = _easyReq(h);
+    if (r == NULL) luaL_error(L, "https.memio() called with a handle that is not live %d", h);
     if (!r->complete)  luaL_error(L, "https.memio() called on an incomplete request");
     lua_pushIO(L, r->body, r->bodyTotalBytes, 0);
     return 1;
@@ -1740,13 +4311,18 @@ luaL_Reg lfunc[] = {
     { "get", lua_Get  },
     { "post", lua_Post  },
     { "head", lua_Head  },
+    { "getMany", lua_GetMany  },
+    { "prepare", lua_Prepare  },
+    { "fire", lua_Fire  },
     { "body", lua_Body  },
+    { "chunks", lua_Chunks  },
     { "memio", lua_Memio  },
     { NULL, NULL },
 };
 
 int luaopen_libhttps(lua_State* L) {
     lState = L;
+    lua_CacheEventNames(L);
     lua_pushlightuserdata(L, &_luaIdLocation);
     lua_newtable (L);
     lua_rawset (L, LUA_REGISTRYINDEX);
@@ -1757,7 +4333,8 @@ int luaopen_libhttps(lua_State* L) {
         lua_getfield(L, -1, "getVersion");
         if (lua_isfunction(L, -1)) {
             libhttpsLove = true;
-            easySetupThreaded(luaLove_Callback, 0, 0);
+            easySetupThreaded(NULL, 0, 0);
+            easySetEventCallback(luaLove_Events, true);
             lua_getregtable(L);
             lua_pushinteger(L, 2422422);
             lua_rawseti(L, -2, 1421421);
@@ -21,17 +21,38 @@ typedef void* httpsInitData;
 #define HTTPS_VERSION_NUM   0x0100
 #define HTTPS_VERSION_STR   "01.00"
 
-// maximum simultaneous requests allowed
+// request slots allocated at httpsInit(), the table grows on demand from there
 #define MAX_REQUEST 128
+// hard limit on simultaneous requests (the table grows in slabs of REQUEST_SLAB_SIZE)
+#define REQUEST_SLAB_SIZE 64
+#define MAX_REQUEST_SLABS 1024
+#define MAX_REQUEST_LIMIT (REQUEST_SLAB_SIZE * MAX_REQUEST_SLABS)
 // maximum headers allowed in a request (Apache 2.3 gives us an idea, 100 so we use it)
 #define MAX_HEADERS 100
 // maximum number of possible fixed buffers (and never ever more than 65536)
 #define MAX_FIXED_BUFFERS 128
+// bytes of body every request holds in itself, larger bodies spill to a pooled buffer
+#define HTTPS_INLINE_BYTES 2048
+// bytes in each body chunk (HTTPS_CHUNK_BUFFER), and how many idle chunks are kept for reuse
+#define HTTPS_CHUNK_BYTES 65536
+#define MAX_POOLED_CHUNKS 256
+// transfers running at once by default, past that requests wait their turn (see httpsSetLimits())
+#define HTTPS_ACTIVE_LIMIT 256
 
+// request headers packed as an offset table and a string pool, both in the same allocation as
+// this struct until they outgrow HTTPS_HEADER_PAIRS / HTTPS_HEADER_POOL (then in one block of their own)
+#define HTTPS_HEADER_PAIRS 32
+#define HTTPS_HEADER_POOL 2048
 typedef struct _httpsHeaders {
     int count;
-    char *str[MAX_HEADERS*2];
+    int capacity;               // name/value pairs the offset table holds
+    unsigned int used;          // pool bytes in use
+    unsigned int size;          // pool bytes
+    unsigned int *offset;       // header i is named pool + offset[i*2], its value is pool + offset[i*2+1]
+    char *pool;
 } httpsHeaders;
+#define HTTPS_HEADER_NAME(h, i)     ((h)->pool + (h)->offset[(i)*2])
+#define HTTPS_HEADER_VALUE(h, i)    ((h)->pool + (h)->offset[(i)*2+1])
 
 typedef struct _httpsMemoryInterface {
     void* (*malloc)(size_t bytes);
@@ -45,6 +66,17 @@ typedef struct _httpsSystemInfo {
     int maxRequests;
     int activeRequests;
     unsigned int bufferBytes;
+    // transport counters since init (linux only)
+    long long transfers;
+    long long newConnections;       // transfers - newConnections is how many reused a connection
+    double handshakeSeconds;        // time spent in tls handshakes on new connections
+    long long resumedSessions;      // new tls connections that resumed a session (abbreviated handshake), stays 0 unless curl uses openssl
+    // read buffers served from the size-classed pool vs. from malloc, since init
+    long long poolHits;
+    long long poolMisses;
+    // admission: transfers counted against the limits, and requests waiting for room
+    int runningRequests;
+    int queuedRequests;
 } httpsSystemInfo;
 
 typedef struct _memBuffer {
@@ -60,16 +92,38 @@ typedef struct _memBuffer {
 // void* is the httpsReq* that called for this listing, you can get and set *userData in there
 typedef int (*httpsHeaderLister)(const char* name, const char* value, void* r);
 
+// what the library has learned about response sizes from one endpoint (host and first path segment)
+typedef struct _httpsSizeEstimate {
+    char endpoint[64];
+    double meanBytes;               // moving average of body sizes
+    double deviationBytes;          // moving average of how far they stray from it
+    unsigned int samples;
+    unsigned long initialBytes;     // what a request to it starts with now
+} httpsSizeEstimate;
+
+// one piece of a chunked body, like a struct iovec
+typedef struct _httpsIovec {
+    const void *base;
+    unsigned int len;
+} httpsIovec;
+
 // a flush routine to call when a read buffer is full
 typedef void (*httpsFlush)(int index, const char* URL, void *user, memBuffer *p);
 
+// a streaming sink, gets each chunk of the body as the transport receives it (on the transport thread),
+// data is only valid during the call, return bytes to continue or 0 to abort the transfer
+typedef int (*httpsSink)(void *r, const char *data, unsigned int bytes, void *user);
+
 #define HTTPS_FIXED_BUFFER          0x01000000      // a fixed buffer for this request
 #define HTTPS_PERSISTENT_BUFFER     0x03000000      // use an established already existing buffer (always also fixed size)
 #define HTTPS_REUSE_BUFFER          0x04000000      // reuse a buffer, using a flush callback each time it's full
 #define HTTPS_DOUBLE_UNTIL          0x08000000      // double realloc() until we hit a set size and them just allocated that size over and over (2x, 3x, etc.)
-#define HTTPS_DOUBLE_FOREVER(x)     ((x & 0xFF000000) == 0)      
+#define HTTPS_DOUBLE_FOREVER(x)     ((x & 0x7F000000) == 0)      
                                                     // just double each time we realloc()
 #define HTTPS_SLOT_REQUEST          0x10000000      // a slot request
+#define HTTPS_STREAM                0x20000000      // no read buffer, the body goes to a sink as it arrives (httpsGetStreamed)
+#define HTTPS_CHUNK_BUFFER          0x40000000      // the body is a list of pooled chunks that never move (httpsGetBodyChunks)
+#define HTTPS_BACKGROUND            0x80000000      // background priority: waits behind interactive requests, and leaves them a quarter of the active limit
 #define HTTPS_SLOT(x)               (x & 0xFF)      // the slot value
 #define HTTPS_BUFFER_KB(x)          (x & 0xFFFFFF)  // ~ 16GB is the largest fixed buffer we can support, allocated as 1 kb units
 #define HTTPS_PERSIST_ID(x)         (x & 0xFFFF)    // 65536 possible persistant buffers
@@ -82,6 +136,7 @@ void httpsCleanup();
 void httpsUseMemoryInterface(httpsMemoryInterface *p);
 void httpsSetFlushRoutine(httpsFlush f);
 void httpsGetInfo(httpsSystemInfo *info);
+void httpsReserveRequests(unsigned int count);
 void httpsEnsurePersistentBuffers(int i);
 int httpsAddPersistentBuffer(char *bmem, unsigned int bytes);
 void httpsRemovePersistentBuffer(int id);
@@ -91,12 +146,36 @@ void* httpsPost(const char *URL, int flags, const char *body, unsigned int bodyB
 // in the linked case, we don't copy body at all and expect you to only free it when we are done!
 void* httpsPostLinked(const char *URL, int flags, const char *body, unsigned int bodyBytes, void *headers);
 void* httpsHead(const char *URL, int flags, void *headers);
+// the body is never buffered, each chunk goes straight to sink (HTTPS_STREAM is implied)
+void* httpsGetStreamed(const char *URL, int flags, void *headers, httpsSink sink, void *user);
+// request templates: the url is checked and the method, headers and transport header list are built once,
+// method is "GET" (NULL), "POST" or "HEAD", returns NULL for a url that isn't http(s)://host...
+void* httpsPrepare(const char *URL, const char *method, void *headers, const char *body, unsigned int bodyBytes);
+// a request from a template, query is added to the url and body replaces the prepared one (either can be NULL)
+void* httpsFire(void *prepared, int flags, const char *query, const char *body, unsigned int bodyBytes);
+// requests already fired keep the template alive until they are released
+void httpsUnprepare(void *prepared);
+// start count requests at once (buffered, no body), each transport thread gets its share in one go with one wakeup,
+// out gets each one's request (NULL if it didn't start), returns how many started
+int httpsSubmitBatch(const char *method, const char **URLs, int count, int flags, void *headers, void **out);
+// admission: transfers allowed to run at once in all and per host (0 unlimited), requests past that still get made
+// but wait, interactive before HTTPS_BACKGROUND then earliest deadline first, until httpsUpdate() has room for them
+// (a background request still waiting past its deadline goes ahead of interactive ones)
+void httpsSetLimits(int active, int perHost);
+// a request that has to wait should start within seconds from now (without one it gets 30 seconds from when it was made)
+void httpsSetDeadline(void *p, double seconds);
 int httpsGetCode(void *p);
 int httpsGetCodeI(int i);
 const char* httpsGetHeader(void *p, const char *w);
 unsigned int httpsGetBodyLength(void *p);
 void httpsGetBody(void *p, unsigned int maxBytes);
 void httpsGetBodyBuffer(void *p, memBuffer *b);
+// chunked bodies: fills up to max pieces in order and returns how many there are in all
+int httpsGetBodyChunks(void *p, httpsIovec *iov, int max);
+// chunked bodies: copy a complete body into one buffer (the chunks go back to the pool), false if still reading
+bool httpsFlattenBody(void *p);
+// the endpoints being sized, fills up to max and returns how many there are
+int httpsGetSizeEstimates(httpsSizeEstimate *out, int max);
 void httpsListHeaders(void *p, httpsHeaderLister lister);
 bool httpsIsComplete(void* p);
 void httpsFinished(void* p);
@@ -113,6 +192,30 @@ void httpsRelease(void *p);
 // high-level callbacks
 typedef void (*easyCallback)(int handle, const char* url, const char* msg, int code, unsigned int sz, void* data);
 
+// the same events by number for easySetEventCallback(), msg is the name easyCallback gets
+#define EASY_EVENT_START    1       // "START" the request was started
+#define EASY_EVENT_UPDATE   2       // "UPDATE" code changed
+#define EASY_EVENT_HEADERS  3       // "httpsHeaders" all headers are in, data is a header reader
+#define EASY_EVENT_LENGTH   4       // "LENGTH" code is the content length
+#define EASY_EVENT_MIME     5       // "MIME" data is the mime type
+#define EASY_EVENT_READ     6       // "READ" code is the bytes read so far
+#define EASY_EVENT_COMPLETE 7       // "COMPLETE" data is the body buffer and sz its length, with HTTPS_CHUNK_BUFFER
+                                    // the buffer is empty and the sz bytes are read with httpsGetBodyChunks()
+#define EASY_EVENT_CHUNK    8       // "CHUNK" data is sz streamed bytes, only valid during the callback
+#define EASY_EVENT_COUNT    9
+#define EASY_EVENT_MASK(e)  (1u << (e))     // for easyRequestOptions.events
+
+typedef struct _easyEvent {
+    int event;                  // EASY_EVENT_*
+    int handle;
+    const char *url;
+    int code;
+    unsigned int sz;
+    void *data;
+} easyEvent;
+
+typedef void (*easyEventCallback)(const easyEvent *events, int count);
+
 // a message block for threaded messages in the easy system
 typedef struct _easyMessage {
     unsigned short version;     // must be 0x100 to 0x01FF (00-FF for revisions to type 1 message)
@@ -125,25 +228,64 @@ typedef struct _easyMessage {
     void *data;
     void *user;
     void *flush;
+    int event;                  // EASY_EVENT_* of a message for the main thread
 } easyMessage;
 
 void easySetup(easyCallback cb, unsigned int bsize);
+// slotCount is where the threaded handle table starts (0 default, 50), it grows as handles run out
 void easySetupThreaded(easyCallback cb, unsigned int msgQueDepth, unsigned int slotCount);
+// take events by number instead of by name (after setup, cb NULL goes back to the easyCallback), batched
+// gets everything since the last easyUpdate() in one call, otherwise it is called once per event
+void easySetEventCallback(easyEventCallback cb, bool batched);
 void easyListHeaders(int h, httpsHeaderLister lister);
+void easyRelease(int h);    // done with a handle, threaded the request is handed back on the worker
+// options for easyOptionUI()/easyOptionD(), transport options must be set before setup
+#define EASY_OPT_FLAGS      1
+#define EASY_OPT_DELAY      2
+#define EASY_OPT_BACKEND    3       // linux: 0 poll loop (default), 1 epoll socket loop
+#define EASY_OPT_WORKERS    4       // linux: transfer threads, 0 (default) is one per processor
+#define EASY_OPT_REQUESTS   5       // request slots to reserve up front (the table still grows on demand)
+#define EASY_OPT_HANDLES    6       // linux: idle curl handles kept per transfer thread, 0 default (32), < 0 none
+#define EASY_OPT_DNS_TTL    7       // linux: seconds resolved hosts stay cached, 0 default (60), < 0 forever
+#define EASY_OPT_CONNECTIONS 8      // linux: idle connections kept open per transfer thread, 0 curl's default
+#define EASY_OPT_HTTP       9       // linux: 0 curl's choice, 1 http/1.1, 2 h2 over tls (multiplexed), 3 h2c prior knowledge
+#define EASY_OPT_STREAMS    10      // linux: h2 streams per connection, 0 curl's default (100)
+#define EASY_OPT_HOST_CONNECTIONS 11    // linux: connections per host, 0 unlimited
+#define EASY_OPT_TOTAL_CONNECTIONS 12   // linux: connections per transfer thread, 0 unlimited
+#define EASY_OPT_STREAM_WEIGHT 13   // linux: h2 stream weight 1-256 for requests, 0 default (16)
+#define EASY_OPT_ACTIVE     14      // transfers running at once, 0 unlimited (default HTTPS_ACTIVE_LIMIT), past it requests wait
+#define EASY_OPT_HOST_ACTIVE 15     // transfers running at once per host, 0 unlimited (default)
+
+// per request extras for easyGetWith(), all zero is a plain easyGet()
+typedef struct _easyRequestOptions {
+    double deadline;            // seconds it should start within if it has to wait for room, 0 none
+    unsigned int events;        // EASY_EVENT_MASK()s of the events wanted, 0 all of them (COMPLETE always comes)
+    unsigned int progressBytes; // READ at most once per this many bytes, 0 every read
+    double progressSeconds;     // READ at most once per this many seconds, 0 every read (the last READ comes either way)
+} easyRequestOptions;
+
 void easyOptionUI(unsigned int opt, unsigned int val);
 void easyOptionD(unsigned int opt, double val);
 int easyHasMetrics(int i);
 double easyGetMetricD(int i, int w);
 int easyGetMetricI(int i, int w);
 const char *easyGetMetricS(int i, int w);
-void easyUpdate();	// if you call this is counts as calling the low-level httpsUpdate() above, FYI
+void easyUpdate();	// if you call this is counts as calling the low-level httpsUpdate() above, FYI (threaded it only delivers the worker's messages)
 int easyGet(const char *URL, int flags, const char* *headers, int header_count, bool header_compact);
+int easyGetWith(const char *URL, int flags, const char* *headers, int header_count, bool header_compact,
+                    const easyRequestOptions *options);
 int easyPost(const char *URL, int flags, const char *body, unsigned int bodyBytes, const char* *headers, int header_count, bool header_compact);
 int easyHead(const char *URL, int flags, const char* *headers, int header_count, bool header_compact);
 // if we have headers to just pass through easily, provide that option
 int easyGetPass(const char *URL, int flags, httpsHeaders *h);
 int easyPostPass(const char *URL, int flags, const char *body, unsigned int bodyBytes, httpsHeaders *h);
 int easyHeadPass(const char *URL, int flags, httpsHeaders *h);
+// templates for requests made over and over, free them with httpsUnprepare()
+void* easyPrepare(const char *URL, const char *method, const char* *headers, int header_count, bool header_compact,
+                    const char *body, unsigned int bodyBytes);
+int easyFire(void *prepared, int flags, const char *query, const char *body, unsigned int bodyBytes);
+// gets for a whole list of urls with the same headers, handles gets each one's handle (or -1), returns how many started
+int easyGetMany(const char* *URLs, int count, int flags, const char* *headers, int header_count, bool header_compact, int *handles);
 
 int luaopen_libhttps(lua_State* L);
 
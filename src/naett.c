@@ -11,6 +11,7 @@
 
 #ifdef _MSC_VER 
     #define strcasecmp _stricmp
+    #define strncasecmp _strnicmp
     #define min(a,b) (((a)<(b))?(a):(b))
 #endif
 
@@ -43,11 +44,40 @@
 
 #define naettAlloc(TYPE, VAR) TYPE* VAR = (TYPE*)calloc(1, sizeof(TYPE))
 
-typedef struct KVLink {
-    const char* key;
+// Bump allocator for data that lives exactly as long as its response, freed in one go.
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+#define ARENA_CHUNK_SIZE 4096
+
+// A response header, name and value share one arena allocation.
+typedef struct {
+    unsigned int hash;
+    char* key;
     const char* value;
-    struct KVLink* next;
-} KVLink;
+} HeaderEntry;
+
+// Response headers in arrival order, with an open addressing index over them keyed by
+// case folded name hash. A full block is replaced by a bigger copy rather than grown in
+// place, the old one stays in the arena so a reader never sees freed memory.
+typedef struct HeaderBlock {
+    int capacity;
+    int count;
+    int* index;  // 2 * capacity slots, entry + 1, 0 when empty, the newest entry for a name wins
+    HeaderEntry entries[];
+} HeaderBlock;
+
+// Request headers packed as name\0value\0 pairs in one allocation, in the order they were added.
+typedef struct {
+    char* data;
+    size_t used;
+    size_t size;
+    int count;
+} HeaderPack;
 
 typedef struct Buffer {
     void* data;
@@ -63,13 +93,16 @@ typedef struct {
     void* bodyReaderData;
     naettWriteFunc bodyWriter;
     void* bodyWriterData;
-    KVLink* headers;
+    naettEventFunc eventHandler;
+    void* eventHandlerData;
+    HeaderPack headers;
     Buffer body;
 } RequestOptions;
 
-typedef struct {
+typedef struct InternalRequest {
     RequestOptions options;
     const char* url;
+    const struct InternalRequest* base;  // the request this one was made from, if any
 #if __APPLE__
     id urlRequest;
 #endif
@@ -83,13 +116,18 @@ typedef struct {
     LPWSTR host;
     LPWSTR resource;
 #endif
+#if __LINUX__
+    struct curl_slist* headerList;
+#endif
 } InternalRequest;
 
 typedef struct {
     InternalRequest* request;
     int code;
     int complete;
-    KVLink* headers;
+    HeaderBlock* headers;
+    naettHeaderInfo headerInfo;
+    ArenaChunk* arena;
     Buffer body;
 #if __APPLE__
     id session;
@@ -99,7 +137,8 @@ typedef struct {
     int closeRequested;
 #endif
 #if __LINUX__
-    struct curl_slist* headerList;
+    CURL* curl;
+    int resumed;
 #endif
 #if __WINDOWS__
     char buffer[10240];
@@ -108,8 +147,11 @@ typedef struct {
 } InternalResponse;
 
 void naettPlatformInit(naettInitData initData);
+long naettConfigValue(int option);
+void naettCountTransfer(long connections, long long handshakeMicroseconds, int resumed);
 int naettPlatformInitRequest(InternalRequest* req);
 void naettPlatformMakeRequest(InternalResponse* res);
+void naettPlatformMakeMany(InternalResponse** responses, int count);
 void naettPlatformFreeRequest(InternalRequest* req);
 void naettPlatformCloseResponse(InternalResponse* res);
 
@@ -168,16 +210,72 @@ static void ptrSetter(InternalParamPtr param, InternalRequest* req) {
     *ptrField = param->ptr;
 }
 
+// Room for bytes more in a header pack.
+static int packReserve(HeaderPack* pack, size_t bytes) {
+    if (pack->used + bytes <= pack->size) {
+        return 1;
+    }
+    size_t size = pack->size ? pack->size * 2 : 256;
+    while (size < pack->used + bytes) {
+        size *= 2;
+    }
+    char* grown = (char*)realloc(pack->data, size);
+    if (grown == NULL) {
+        return 0;
+    }
+    pack->data = grown;
+    pack->size = size;
+    return 1;
+}
+
+static void packAdd(HeaderPack* pack, const char* key, const char* value) {
+    size_t keyLength = strlen(key) + 1;
+    size_t valueLength = strlen(value) + 1;
+    if (!packReserve(pack, keyLength + valueLength)) {
+        return;
+    }
+    memcpy(pack->data + pack->used, key, keyLength);
+    memcpy(pack->data + pack->used + keyLength, value, valueLength);
+    pack->used += keyLength + valueLength;
+    pack->count++;
+}
+
+// Walks a header pack: pass NULL to start, each call fills key and value and returns where
+// the next header is, NULL once they are all done.
+static const char* nextHeader(const HeaderPack* pack, const char* at, const char** key, const char** value) {
+    if (at == NULL) {
+        at = pack->data;
+    }
+    if (at == NULL || at >= pack->data + pack->used) {
+        return NULL;
+    }
+    *key = at;
+    *value = at + strlen(at) + 1;
+    return *value + strlen(*value) + 1;
+}
+
 static void kvSetter(InternalParamPtr param, InternalRequest* req) {
     char* opaque = (char*)&req->options;
-    KVLink** kvField = (KVLink**)(opaque + param->offset);
-
-    naettAlloc(KVLink, newNode);
-    newNode->key = strdup(param->kv.key);
-    newNode->value = strdup(param->kv.value);
-    newNode->next = *kvField;
+    HeaderPack* pack = (HeaderPack*)(opaque + param->offset);
+    packAdd(pack, param->kv.key, param->kv.value);
+}
 
-    *kvField = newNode;
+// The option already holds the headers packed, an empty pack adopts them as they are.
+static void packSetter(InternalParamPtr param, InternalRequest* req) {
+    char* opaque = (char*)&req->options;
+    HeaderPack* pack = (HeaderPack*)(opaque + param->offset);
+    HeaderPack* block = (HeaderPack*)param->ptr;
+    if (pack->data == NULL) {
+        *pack = *block;
+    } else {
+        if (packReserve(pack, block->used)) {
+            memcpy(pack->data + pack->used, block->data, block->used);
+            pack->used += block->used;
+            pack->count += block->count;
+        }
+        free(block->data);
+    }
+    free(block);
 }
 
 static int defaultBodyReader(void* dest, int bufferSize, void* userData) {
@@ -218,6 +316,8 @@ static int defaultBodyWriter(const void* source, int bytes, void* userData) {
 }
 
 static int initialized = 0;
+static long configValues[naettConfigCount];
+static naettStats stats;
 
 static void initRequest(InternalRequest* req, const char* url) {
     assert(initialized);
@@ -233,6 +333,18 @@ static void applyOptionParams(InternalRequest* req, InternalOption* option) {
     }
 }
 
+long naettConfigValue(int option) {
+    return configValues[option];
+}
+
+// platform code calls this from its transfer threads as transfers finish
+void naettCountTransfer(long connections, long long handshakeMicroseconds, int resumed) {
+    __atomic_fetch_add(&stats.transfers, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.connections, connections, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.handshakeMicroseconds, handshakeMicroseconds, __ATOMIC_RELAXED);
+    if (resumed) __atomic_fetch_add(&stats.resumedSessions, 1, __ATOMIC_RELAXED);
+}
+
 // Public API
 
 void naettInit(naettInitData initData) {
@@ -241,6 +353,20 @@ void naettInit(naettInitData initData) {
     initialized = 1;
 }
 
+void naettConfigure(int option, long value) {
+    if (option > 0 && option < naettConfigCount) {
+        configValues[option] = value;
+    }
+}
+
+void naettGetStats(naettStats* out) {
+    assert(out != NULL);
+    out->transfers = __atomic_load_n(&stats.transfers, __ATOMIC_RELAXED);
+    out->connections = __atomic_load_n(&stats.connections, __ATOMIC_RELAXED);
+    out->handshakeMicroseconds = __atomic_load_n(&stats.handshakeMicroseconds, __ATOMIC_RELAXED);
+    out->resumedSessions = __atomic_load_n(&stats.resumedSessions, __ATOMIC_RELAXED);
+}
+
 naettOption* naettMethod(const char* method) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -266,6 +392,32 @@ naettOption* naettHeader(const char* name, const char* value) {
     return (naettOption*)option;
 }
 
+naettOption* naettHeaderBlock(int count, const char* pool, const unsigned int* offsets) {
+    naettAlloc(HeaderPack, block);
+    size_t bytes = 0;
+    for (int i = 0; i < count * 2; i++) {
+        bytes += strlen(pool + offsets[i]) + 1;
+    }
+    block->data = (char*)malloc(bytes ? bytes : 1);
+    block->size = bytes;
+    for (int i = 0; i < count * 2; i++) {
+        size_t length = strlen(pool + offsets[i]) + 1;
+        memcpy(block->data + block->used, pool + offsets[i], length);
+        block->used += length;
+    }
+    block->count = count;
+
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->ptr = block;
+    param->offset = offsetof(RequestOptions, headers);
+    param->setter = packSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettTimeout(int timeoutMS) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -314,6 +466,24 @@ naettOption* naettBodyReader(naettReadFunc reader, void* userData) {
     return (naettOption*)option;
 }
 
+naettOption* naettEventHandler(naettEventFunc handler, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* handlerParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    handlerParam->func = (void(*)(void)) handler;
+    handlerParam->offset = offsetof(RequestOptions, eventHandler);
+    handlerParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, eventHandlerData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     naettAlloc(InternalOption, option);
     option->numParams = 2;
@@ -332,6 +502,28 @@ naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     return (naettOption*)option;
 }
 
+// Platform code reports state changes through these two, always from the transport thread.
+
+static void notifyHeaders(InternalResponse* res) {
+    RequestOptions* options = &res->request->options;
+    if (options->eventHandler != NULL) {
+        options->eventHandler(naettEventHeaders, (naettRes*)res, options->eventHandlerData);
+    }
+}
+
+static void markComplete(InternalResponse* res) {
+    if (res->complete) {
+        return;
+    }
+    // once complete is set the owner may close the response, so grab the handler first
+    naettEventFunc handler = res->request->options.eventHandler;
+    void* handlerData = res->request->options.eventHandlerData;
+    res->complete = 1;
+    if (handler != NULL) {
+        handler(naettEventComplete, (naettRes*)res, handlerData);
+    }
+}
+
 void setupDefaultRW(InternalRequest* req) {
     if (req->options.bodyReader == NULL) {
         req->options.bodyReader = defaultBodyReader;
@@ -394,22 +586,85 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
     return NULL;
 }
 
-naettRes* naettMake(naettReq* request) {
-    assert(initialized);
-    assert(request != NULL);
+naettReq* naettRequestFrom(naettReq* base, const char* url, int numOptions, const naettOption** options) {
+    assert(base != NULL);
+    assert(numOptions == 0 || options != NULL);
 
-    InternalRequest* req = (InternalRequest*)request;
+    const InternalRequest* from = (const InternalRequest*)base;
+    naettAlloc(InternalRequest, req);
+    initRequest(req, url != NULL ? url : from->url);
+    req->base = from;
+
+    // everything the base was given, with copies of the parts a request owns
+    free((void*)req->options.method);
+    req->options = from->options;
+    req->options.method = strdup(from->options.method);
+    memset(&req->options.headers, 0, sizeof(HeaderPack));
+    if (from->options.headers.used > 0 && packReserve(&req->options.headers, from->options.headers.used)) {
+        memcpy(req->options.headers.data, from->options.headers.data, from->options.headers.used);
+        req->options.headers.used = from->options.headers.used;
+        req->options.headers.count = from->options.headers.count;
+    }
+    if (req->options.bodyReader == defaultBodyReader) {
+        req->options.bodyReader = NULL;
+    }
+
+    for (int i = 0; i < numOptions; i++) {
+        InternalOption* option = (InternalOption*)options[i];
+        applyOptionParams(req, option);
+        free(option);
+    }
+
+    setupDefaultRW(req);
+
+    if (naettPlatformInitRequest(req)) {
+        return (naettReq*)req;
+    }
+
+    naettFree((naettReq*) req);
+    return NULL;
+}
+
+static InternalResponse* newResponse(InternalRequest* req) {
     naettAlloc(InternalResponse, res);
     res->request = req;
+    res->headerInfo.contentLength = -1;
 
     if (req->options.bodyWriter == defaultBodyWriter) {
         req->options.bodyWriterData = (void*) &res->body;
     }
+    return res;
+}
+
+naettRes* naettMake(naettReq* request) {
+    assert(initialized);
+    assert(request != NULL);
 
+    InternalResponse* res = newResponse((InternalRequest*)request);
     naettPlatformMakeRequest(res);
     return (naettRes*) res;
 }
 
+void naettMakeMany(naettReq* const* requests, naettRes** responses, int count) {
+    assert(initialized);
+    assert(count == 0 || (requests != NULL && responses != NULL));
+
+    for (int i = 0; i < count; i++) {
+        assert(requests[i] != NULL);
+        responses[i] = (naettRes*)newResponse((InternalRequest*)requests[i]);
+    }
+    naettPlatformMakeMany((InternalResponse**)responses, count);
+}
+
+#if !__LINUX__
+// Nothing to batch on platforms without transfer threads of their own, one at a time it is.
+void naettPlatformMakeMany(InternalResponse** responses, int count) {
+    for (int i = 0; i < count; i++) {
+        naettPlatformMakeRequest(responses[i]);
+    }
+}
+#endif
+
 const void* naettGetBody(naettRes* response, int* size) {
     assert(response != NULL);
     assert(size != NULL);
@@ -419,19 +674,150 @@ const void* naettGetBody(naettRes* response, int* size) {
     return res->body.data;
 }
 
+static void* arenaAlloc(ArenaChunk** arena, size_t bytes) {
+    bytes = (bytes + 7) & ~(size_t)7;
+    ArenaChunk* chunk = *arena;
+    if (chunk == NULL || chunk->size - chunk->used < bytes) {
+        size_t size = bytes > ARENA_CHUNK_SIZE ? bytes : ARENA_CHUNK_SIZE;
+        chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = *arena;
+        *arena = chunk;
+    }
+    void* p = chunk->data + chunk->used;
+    chunk->used += bytes;
+    return p;
+}
+
+static void arenaFree(ArenaChunk* arena) {
+    while (arena != NULL) {
+        ArenaChunk* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
+
+static unsigned int headerHash(const char* name, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+// The index slot holding name, or the empty slot where it would go.
+static int headerSlot(const HeaderBlock* block, unsigned int hash, const char* name) {
+    int mask = block->capacity * 2 - 1;
+    int slot = hash & mask;
+    while (block->index[slot] != 0) {
+        const HeaderEntry* entry = &block->entries[block->index[slot] - 1];
+        if (entry->hash == hash && strcasecmp(entry->key, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static HeaderBlock* newHeaderBlock(InternalResponse* res, HeaderBlock* old) {
+    int capacity = old ? old->capacity * 2 : 16;
+    size_t size = sizeof(HeaderBlock) + sizeof(HeaderEntry) * capacity + sizeof(int) * capacity * 2;
+    HeaderBlock* block = (HeaderBlock*)arenaAlloc(&res->arena, size);
+    if (block == NULL) {
+        return NULL;
+    }
+    memset(block, 0, size);
+    block->capacity = capacity;
+    block->index = (int*)&block->entries[capacity];
+    if (old) {
+        for (int i = 0; i < old->count; i++) {
+            block->entries[i] = old->entries[i];
+            block->index[headerSlot(block, old->entries[i].hash, old->entries[i].key)] = i + 1;
+        }
+        block->count = old->count;
+    }
+    return block;
+}
+
+static int headerIs(const char* name, size_t length, const char* known) {
+    return length == strlen(known) && strncasecmp(name, known, length) == 0;
+}
+
+// Platform code hands each response header to this as it arrives. The value is trimmed of
+// surrounding whitespace and line endings.
+static void addHeader(InternalResponse* res, const char* name, size_t nameLength, const char* value, size_t valueLength) {
+    while (valueLength > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        valueLength--;
+    }
+    while (valueLength > 0 && (value[valueLength - 1] == '\r' || value[valueLength - 1] == '\n' || value[valueLength - 1] == ' ')) {
+        valueLength--;
+    }
+
+    HeaderBlock* block = res->headers;
+    if (block == NULL || block->count == block->capacity) {
+        block = newHeaderBlock(res, block);
+        if (block == NULL) {
+            return;
+        }
+    }
+
+    char* key = (char*)arenaAlloc(&res->arena, nameLength + valueLength + 2);
+    if (key == NULL) {
+        return;
+    }
+    memcpy(key, name, nameLength);
+    key[nameLength] = 0;
+    memcpy(key + nameLength + 1, value, valueLength);
+    key[nameLength + 1 + valueLength] = 0;
+
+    HeaderEntry* entry = &block->entries[block->count];
+    entry->hash = headerHash(key, nameLength);
+    entry->key = key;
+    entry->value = key + nameLength + 1;
+    block->index[headerSlot(block, entry->hash, key)] = block->count + 1;
+    block->count++;
+    res->headers = block;
+
+    naettHeaderInfo* info = &res->headerInfo;
+    if (headerIs(key, nameLength, "Content-Length")) {
+        info->contentLength = strtoll(entry->value, NULL, 10);
+    } else if (headerIs(key, nameLength, "Content-Type")) {
+        info->contentType = entry->value;
+    } else if (headerIs(key, nameLength, "ETag")) {
+        info->etag = entry->value;
+    } else if (headerIs(key, nameLength, "Cache-Control")) {
+        info->cacheControl = entry->value;
+    } else if (headerIs(key, nameLength, "Location")) {
+        info->location = entry->value;
+    }
+}
+
 const char* naettGetHeader(naettRes* response, const char* name) {
     assert(response != NULL);
     assert(name != NULL);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (strcasecmp(name, node->key) == 0) {
-            return node->value;
-        }
-        node = node->next;
+    HeaderBlock* block = res->headers;
+    if (block == NULL) {
+        return NULL;
     }
-    return NULL;
+    int entry = block->index[headerSlot(block, headerHash(name, strlen(name)), name)];
+    return entry ? block->entries[entry - 1].value : NULL;
+}
+
+const naettHeaderInfo* naettGetHeaderInfo(naettRes* response) {
+    assert(response != NULL);
+    InternalResponse* res = (InternalResponse*)response;
+    return &res->headerInfo;
 }
 
 void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userData) {
@@ -439,12 +825,14 @@ void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userDa
     assert(lister != NULL);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (!lister(node->key, node->value, userData)) {
+    HeaderBlock* block = res->headers;
+    if (block == NULL) {
+        return;
+    }
+    for (int i = 0; i < block->count; i++) {
+        if (!lister(block->entries[i].key, block->entries[i].value, userData)) {
             return;
         }
-        node = node->next;
     }
 }
 
@@ -466,23 +854,12 @@ int naettGetStatus(const naettRes* response) {
     return res->code;
 }
 
-static void freeKVList(KVLink* node) {
-    while (node != NULL) {
-        free((void*) node->key);
-        free((void*) node->value);
-        KVLink* next = node->next;
-        free(node);
-        node = next;
-    }
-}
-
 void naettFree(naettReq* request) {
     assert(request != NULL);
 
     InternalRequest* req = (InternalRequest*)request;
     naettPlatformFreeRequest(req);
-    KVLink* node = req->options.headers;
-    freeKVList(node);
+    free(req->options.headers.data);
     free((void*)req->url);
     free(request);
 }
@@ -493,8 +870,8 @@ void naettClose(naettRes* response) {
     InternalResponse* res = (InternalResponse*)response;
     res->request = NULL;
     naettPlatformCloseResponse(res);
-    KVLink* node = res->headers;
-    freeKVList(node);
+    // headers and everything else per response go in one go
+    arenaFree(res->arena);
     free(response);
 }
 // End of inlined naett_core.c //
@@ -615,12 +992,12 @@ int naettPlatformInitRequest(InternalRequest* req) {
         objc_msgSend_t(void, id, id)(request, sel("setValue:forHTTPHeaderField:"), value, name);
     }
 
-    KVLink* header = req->options.headers;
-    while (header != NULL) {
-        id name = NSString(header->key);
-        id value = NSString(header->value);
-        objc_msgSend_t(void, id, id)(request, sel("setValue:forHTTPHeaderField:"), value, name);
-        header = header->next;
+    const char *key, *value;
+    for (const char* at = nextHeader(&req->options.headers, NULL, &key, &value); at != NULL;
+         at = nextHeader(&req->options.headers, at, &key, &value)) {
+        id name = NSString(key);
+        id headerValue = NSString(value);
+        objc_msgSend_t(void, id, id)(request, sel("setValue:forHTTPHeaderField:"), headerValue, name);
     }
 
     char byteBuffer[10240];
@@ -667,12 +1044,11 @@ void didReceiveData(id self, SEL _sel, id session, id dataTask, id data) {
         objc_msgSend_t(NSInteger, id*, id*, NSUInteger)(
             allHeaders, sel("getObjects:andKeys:count:"), headerValues, headerNames, headerCount);
         for (int i = 0; i < headerCount; i++) {
-            naettAlloc(KVLink, node);
-            node->key = strdup(objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String")));
-            node->value = strdup(objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String")));
-            node->next = res->headers;
-            res->headers = node;
+            const char* name = objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String"));
+            const char* value = objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String"));
+            addHeader(res, name, strlen(name), value, strlen(value));
         }
+        notifyHeaders(res);
     }
 
     const void* bytes = objc_msgSend_t(const void*)(data, sel("bytes"));
@@ -689,7 +1065,7 @@ static void didComplete(id self, SEL _sel, id session, id dataTask, id error) {
     if (error != nil) {
         res->code = naettConnectionError;
     }
-    res->complete = 1;
+    markComplete(res);
 }
 
 static id createDelegate() {
@@ -751,89 +1127,480 @@ void naettPlatformCloseResponse(InternalResponse* res) {
 #include <curl/curl.h>
 #include <assert.h>
 #include <pthread.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <string.h>
-
-static pthread_t workerThread;
-static int handleReadFD = 0;
-static int handleWriteFD = 0;
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <dlfcn.h>
+#include "xthread.h"
+
+#define EPOLL_BATCH 256
+#define MAX_WORKERS 64
+#define MAX_AUTO_WORKERS 16
+#define DEFAULT_HANDLE_POOL 32
+#define MAX_HANDLE_POOL 1024
+
+typedef struct CurlWorker {
+    pthread_t thread;
+    CURLM* multi;
+    int backend;
+    // handles queued by naettPlatformMakeRequest, waiting to be added to `multi`
+    pthread_mutex_t pendingLock;
+    CURL** pending;
+    int pendingCount;
+    int pendingCapacity;
+    // finished handles, already reset, waiting for a new request (also under pendingLock)
+    CURL** idle;
+    int idleCount;
+    // epoll backend only
+    int epollFD;
+    int wakeFD;
+    long long timerDeadline;
+} CurlWorker;
+
+static CurlWorker* workers = NULL;
+static int workerCount = 0;
+static int handlePoolSize = 0;
 
 static void panic(const char* message) {
     fprintf(stderr, "%s\n", message);
     exit(1);
 }
 
-static void* curlWorker(void* data) {
-    CURLM* mc = (CURLM*)data;
-    int activeHandles = 0;
-    int messagesLeft = 1;
+// DNS results and TLS sessions are shared by every handle on every worker. Connections are not:
+// libcurl does not support one connection cache used from several threads at once, and each
+// host already sticks to one worker, whose multi handle keeps its connections.
+static CURLSH* share = NULL;
+static pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+
+static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userData) {
+    pthread_mutex_lock(&shareLocks[data]);
+}
+
+static void unlockShare(CURL* handle, curl_lock_data data, void* userData) {
+    pthread_mutex_unlock(&shareLocks[data]);
+}
+
+static void initShare() {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&shareLocks[i], NULL);
+    }
+    share = curl_share_init();
+    if (share == NULL) {
+        panic("Failed to create CURL share handle");
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+// count reset handles from the worker's pool, new ones for whatever it can't cover
+static void takeHandles(CurlWorker* w, CURL** handles, int count) {
+    int taken = 0;
+    pthread_mutex_lock(&w->pendingLock);
+    while (taken < count && w->idleCount > 0) {
+        handles[taken++] = w->idle[--w->idleCount];
+    }
+    pthread_mutex_unlock(&w->pendingLock);
+    while (taken < count) {
+        handles[taken++] = curl_easy_init();
+    }
+}
+
+// resets on the worker thread so takeHandles() stays cheap for the caller
+static void recycleHandle(CurlWorker* w, CURL* handle) {
+    curl_easy_reset(handle);
+    pthread_mutex_lock(&w->pendingLock);
+    if (w->idleCount < handlePoolSize) {
+        w->idle[w->idleCount++] = handle;
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&w->pendingLock);
+    if (handle != NULL) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+// hands the worker count handles under one lock, with one wakeup
+static void queueHandles(CurlWorker* w, CURL** handles, int count) {
+    pthread_mutex_lock(&w->pendingLock);
+    if (w->pendingCount + count > w->pendingCapacity) {
+        int newCapacity = w->pendingCapacity ? w->pendingCapacity * 2 : 64;
+        while (newCapacity < w->pendingCount + count) {
+            newCapacity *= 2;
+        }
+        CURL** grown = (CURL**)realloc(w->pending, sizeof(CURL*) * newCapacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&w->pendingLock);
+            panic("Failed to queue request");
+        }
+        w->pending = grown;
+        w->pendingCapacity = newCapacity;
+    }
+    memcpy(w->pending + w->pendingCount, handles, sizeof(CURL*) * count);
+    w->pendingCount += count;
+    pthread_mutex_unlock(&w->pendingLock);
+
+    // kicks the worker out of its wait right away
+    if (w->backend == naettBackendEpoll) {
+        uint64_t one = 1;
+        if (write(w->wakeFD, &one, sizeof(one)) != sizeof(one)) {
+            // the counter is already non-zero, so a wakeup is pending anyway
+        }
+    } else {
+        curl_multi_wakeup(w->multi);
+    }
+}
 
-    struct curl_waitfd readFd = { handleReadFD, CURL_WAIT_POLLIN };
+static void addPendingHandles(CurlWorker* w) {
+    pthread_mutex_lock(&w->pendingLock);
+    for (int i = 0; i < w->pendingCount; i++) {
+        curl_multi_add_handle(w->multi, w->pending[i]);
+    }
+    w->pendingCount = 0;
+    pthread_mutex_unlock(&w->pendingLock);
+}
 
-    union {
-        CURL* handle;
-        char buf[sizeof(CURL*)];
-    } newHandle;
+// OpenSSL's SSL_session_reused(), taken from the libssl curl already loaded rather than linking it ourselves
+typedef int (*SessionReusedFunc)(const void* ssl);
+static SessionReusedFunc sessionReused = NULL;
 
-    int newHandlePos = 0;
+static void findSessionReused(void) {
+    static const char* names[] = { "libssl.so.3", "libssl.so.1.1", "libssl.so" };
+    for (int i = 0; (i < 3) && (sessionReused == NULL); i++) {
+        void* lib = dlopen(names[i], RTLD_LAZY | RTLD_NOLOAD);
+        if (lib != NULL) sessionReused = (SessionReusedFunc)dlsym(lib, "SSL_session_reused");
+    }
+}
+
+static void finishTransfers(CurlWorker* w) {
+    int messagesLeft = 0;
+    struct CURLMsg* message;
+    while ((message = curl_multi_info_read(w->multi, &messagesLeft)) != NULL) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        CURL* handle = message->easy_handle;
+        InternalResponse* res = NULL;
+        long code = 0;
+        long connects = 0;
+        curl_off_t connectTime = 0;
+        curl_off_t appConnectTime = 0;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char**)&res);
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+        curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connectTime);
+        curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &appConnectTime);
+        // appconnect is zero for plain http and for reused connections
+        // resumed was read in headerCallback, by now curl has let go of the connection
+        naettCountTransfer(connects, (connects > 0 && appConnectTime > connectTime) ? appConnectTime - connectTime : 0,
+            connects > 0 && res->resumed);
+        curl_multi_remove_handle(w->multi, handle);
+        recycleHandle(w, handle);
+        res->code = (int)code;
+        markComplete(res);
+    }
+}
+
+static void* pollWorker(void* data) {
+    CurlWorker* w = (CurlWorker*)data;
+    int activeHandles = 0;
 
     while (1) {
-        int status = curl_multi_perform(mc, &activeHandles);
+        addPendingHandles(w);
+
+        int status = curl_multi_perform(w->multi, &activeHandles);
         if (status != CURLM_OK) {
             panic("CURL processing failure");
         }
 
-        int readyFDs = 0;
-        curl_multi_wait(mc, &readFd, 1, 1000, &readyFDs);
+        finishTransfers(w);
 
-        if (readyFDs == 0) {
-            usleep(100 * 1000);
+        // sleeps until socket activity, a curl timeout or curl_multi_wakeup()
+        status = curl_multi_poll(w->multi, NULL, 0, 1000, NULL);
+        if (status != CURLM_OK) {
+            panic("CURL polling failure");
         }
+    }
+
+    return NULL;
+}
+
+static long long monotonicMS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int socketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+    CurlWorker* w = (CurlWorker*)userp;
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(w->epollFD, EPOLL_CTL_DEL, s, NULL);
+        curl_multi_assign(w->multi, s, NULL);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = s;
+    if (what & CURL_POLL_IN) {
+        ev.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        ev.events |= EPOLLOUT;
+    }
 
-        int bytesRead = read(handleReadFD, newHandle.buf, sizeof(newHandle.buf) - newHandlePos);
-        if (bytesRead > 0) {
-            newHandlePos += bytesRead;
+    // socketp is only set once the socket is registered with epoll
+    if (socketp == NULL) {
+        if (epoll_ctl(w->epollFD, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST) {
+            epoll_ctl(w->epollFD, EPOLL_CTL_MOD, s, &ev);
         }
-        if (newHandlePos == sizeof(newHandle.buf)) {
-            curl_multi_add_handle(mc, newHandle.handle);
-            newHandlePos = 0;
+        curl_multi_assign(w->multi, s, w);
+    } else {
+        if (epoll_ctl(w->epollFD, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+            epoll_ctl(w->epollFD, EPOLL_CTL_ADD, s, &ev);
+        }
+    }
+    return 0;
+}
+
+static int timerCallback(CURLM* multi, long timeoutMS, void* userp) {
+    CurlWorker* w = (CurlWorker*)userp;
+    w->timerDeadline = timeoutMS < 0 ? -1 : monotonicMS() + timeoutMS;
+    return 0;
+}
+
+static void* epollWorker(void* data) {
+    CurlWorker* w = (CurlWorker*)data;
+    struct epoll_event events[EPOLL_BATCH];
+    int activeHandles = 0;
+
+    while (1) {
+        int waitMS = -1;
+        if (w->timerDeadline >= 0) {
+            long long left = w->timerDeadline - monotonicMS();
+            waitMS = left > 0 ? (int)left : 0;
+        }
+
+        int ready = epoll_wait(w->epollFD, events, EPOLL_BATCH, waitMS);
+        if (ready < 0 && errno != EINTR) {
+            panic("epoll failure");
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == w->wakeFD) {
+                uint64_t count;
+                if (read(w->wakeFD, &count, sizeof(count)) < 0) {
+                    // nothing to drain, another read got there first
+                }
+                // adding handles arms the curl timer, which starts the transfers
+                addPendingHandles(w);
+                continue;
+            }
+
+            int flags = 0;
+            if (events[i].events & EPOLLIN) {
+                flags |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flags |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                flags |= CURL_CSELECT_ERR;
+            }
+            curl_multi_socket_action(w->multi, fd, flags, &activeHandles);
         }
 
-        struct CURLMsg* message = curl_multi_info_read(mc, &messagesLeft);
-        if (message && message->msg == CURLMSG_DONE) {
-            CURL* handle = message->easy_handle;
-            InternalResponse* res = NULL;
-            curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char**)&res);
-            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &res->code);
-            res->complete = 1;
-            curl_easy_cleanup(handle);
+        if (w->timerDeadline >= 0 && monotonicMS() >= w->timerDeadline) {
+            // the callback may re-arm the timer from inside socket_action
+            w->timerDeadline = -1;
+            curl_multi_socket_action(w->multi, CURL_SOCKET_TIMEOUT, 0, &activeHandles);
         }
+
+        finishTransfers(w);
     }
 
     return NULL;
 }
 
-void naettPlatformInit(naettInitData initData) {
-    curl_global_init(CURL_GLOBAL_ALL);
-    CURLM* mc = curl_multi_init();
-    int fds[2];
-    if (pipe(fds) != 0) {
-        panic("Failed to open pipe");
+static void startWorker(CurlWorker* w, int backend) {
+    w->multi = curl_multi_init();
+    if (w->multi == NULL) {
+        panic("Failed to create CURL multi handle");
+    }
+    w->backend = backend;
+    pthread_mutex_init(&w->pendingLock, NULL);
+    if (naettConfigValue(naettConfigMaxConnects) > 0) {
+        curl_multi_setopt(w->multi, CURLMOPT_MAXCONNECTS, naettConfigValue(naettConfigMaxConnects));
+    }
+    if (naettConfigValue(naettConfigHTTPVersion) >= naettHTTP2) {
+        curl_multi_setopt(w->multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    }
+    if (naettConfigValue(naettConfigMaxStreams) > 0) {
+        curl_multi_setopt(w->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, naettConfigValue(naettConfigMaxStreams));
+    }
+    if (naettConfigValue(naettConfigMaxHostConnections) > 0) {
+        curl_multi_setopt(w->multi, CURLMOPT_MAX_HOST_CONNECTIONS, naettConfigValue(naettConfigMaxHostConnections));
+    }
+    if (naettConfigValue(naettConfigMaxTotalConnections) > 0) {
+        curl_multi_setopt(w->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, naettConfigValue(naettConfigMaxTotalConnections));
+    }
+    if (handlePoolSize > 0) {
+        w->idle = (CURL**)calloc(handlePoolSize, sizeof(CURL*));
+        if (w->idle == NULL) {
+            panic("Failed to allocate handle pool");
+        }
     }
-    handleReadFD = fds[0];
-    handleWriteFD = fds[1];
 
-    int flags = fcntl(handleReadFD, F_GETFL, 0);
-    fcntl(handleReadFD, F_SETFL, flags | O_NONBLOCK);
+    void* (*loop)(void*) = pollWorker;
+    if (backend == naettBackendEpoll) {
+        w->epollFD = epoll_create1(EPOLL_CLOEXEC);
+        w->wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (w->epollFD < 0 || w->wakeFD < 0) {
+            panic("Failed to set up epoll");
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = w->wakeFD;
+        epoll_ctl(w->epollFD, EPOLL_CTL_ADD, w->wakeFD, &ev);
+
+        w->timerDeadline = -1;
+        curl_multi_setopt(w->multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+        curl_multi_setopt(w->multi, CURLMOPT_SOCKETDATA, w);
+        curl_multi_setopt(w->multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+        curl_multi_setopt(w->multi, CURLMOPT_TIMERDATA, w);
+        loop = epollWorker;
+    }
 
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create(&workerThread, &attr, curlWorker, mc);
+    pthread_create(&w->thread, &attr, loop, w);
+}
+
+// FNV-1a over the lowercased authority of the url, so every request to a host lands
+// on the same worker and can reuse that worker's connections
+static CurlWorker* workerForURL(const char* url) {
+    const char* p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    const char* at = NULL;
+    for (const char* q = p; *q && *q != '/' && *q != '?' && *q != '#'; q++) {
+        if (*q == '@') {
+            at = q;
+        }
+    }
+    if (at) {
+        p = at + 1;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (; *p && *p != '/' && *p != '?' && *p != '#'; p++) {
+        hash ^= (uint32_t)tolower((unsigned char)*p);
+        hash *= 16777619u;
+    }
+    return &workers[hash % (uint32_t)workerCount];
+}
+
+void naettPlatformInit(naettInitData initData) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    findSessionReused();
+    int backend = naettConfigValue(naettConfigBackend) == naettBackendEpoll ? naettBackendEpoll : naettBackendPoll;
+
+    long count = naettConfigValue(naettConfigWorkers);
+    if (count <= 0) {
+        count = pcthread_get_num_procs();
+        if (count > MAX_AUTO_WORKERS) {
+            count = MAX_AUTO_WORKERS;
+        }
+    }
+    if (count < 1) {
+        count = 1;
+    }
+    if (count > MAX_WORKERS) {
+        count = MAX_WORKERS;
+    }
+
+    long pool = naettConfigValue(naettConfigHandlePool);
+    if (pool == 0) {
+        pool = DEFAULT_HANDLE_POOL;
+    }
+    handlePoolSize = pool < 0 ? 0 : (pool > MAX_HANDLE_POOL ? MAX_HANDLE_POOL : (int)pool);
+
+    initShare();
+
+    workers = (CurlWorker*)calloc(count, sizeof(CurlWorker));
+    if (workers == NULL) {
+        panic("Failed to allocate workers");
+    }
+    workerCount = (int)count;
+    for (int i = 0; i < workerCount; i++) {
+        startWorker(&workers[i], backend);
+    }
+}
+
+static void setupHTTPVersion(CURL* c) {
+    switch (naettConfigValue(naettConfigHTTPVersion)) {
+        case naettHTTP1:
+            curl_easy_setopt(c, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+            return;
+        case naettHTTP2:
+            curl_easy_setopt(c, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+            break;
+        case naettHTTP2PriorKnowledge:
+            curl_easy_setopt(c, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            break;
+        default:
+            return;
+    }
+    // rather wait for a connection that can multiplex than open another one
+    curl_easy_setopt(c, CURLOPT_PIPEWAIT, 1L);
+    long weight = naettConfigValue(naettConfigStreamWeight);
+    if (weight > 0) {
+        curl_easy_setopt(c, CURLOPT_STREAM_WEIGHT, weight > 256 ? 256L : weight);
+    }
 }
 
+// the header list only depends on the request, so it is built once and kept for every naettMake(),
+// as one allocation: the nodes, then their "name:value" strings (the same bytes as the pack)
 int naettPlatformInitRequest(InternalRequest* req) {
+    static const char userAgent[] = "User-Agent: Naett/1.0";
+    HeaderPack* pack = &req->options.headers;
+
+    // made from another request and no headers added, it sends the same list
+    if (req->base != NULL && req->base->headerList != NULL && pack->count == req->base->options.headers.count) {
+        req->headerList = req->base->headerList;
+        return 1;
+    }
+    int count = pack->count + 1;
+    struct curl_slist* nodes = (struct curl_slist*)malloc(sizeof(struct curl_slist) * count + sizeof(userAgent) + pack->used);
+    if (nodes == NULL) {
+        req->headerList = NULL;
+        return 0;
+    }
+    char* strings = (char*)&nodes[count];
+
+    memcpy(strings, userAgent, sizeof(userAgent));
+    nodes[0].data = strings;
+    strings += sizeof(userAgent);
+
+    const char *key, *value;
+    int i = 1;
+    for (const char* at = nextHeader(pack, NULL, &key, &value); at != NULL; at = nextHeader(pack, at, &key, &value)) {
+        nodes[i - 1].next = &nodes[i];
+        nodes[i].data = strings;
+        strings += sprintf(strings, "%s:%s", key, value) + 1;
+        i++;
+    }
+    nodes[i - 1].next = NULL;
+    req->headerList = nodes;
     return 1;
 }
 
@@ -881,45 +1648,51 @@ static void setupMethod(CURL* curl, const char* method) {
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
 }
 
+// did the connection get away with an abbreviated handshake, only answerable while the transfer
+// still holds it (after CURLMSG_DONE curl hands back no ssl pointer)
+static int resumedSession(CURL* handle) {
+    struct curl_tlssessioninfo* info = NULL;
+    if (sessionReused == NULL) return 0;
+    if (curl_easy_getinfo(handle, CURLINFO_TLS_SSL_PTR, &info) != CURLE_OK) return 0;
+    // plain http or another tls backend
+    if ((info == NULL) || (info->backend != CURLSSLBACKEND_OPENSSL) || (info->internals == NULL)) return 0;
+    return sessionReused(info->internals) == 1;
+}
+
 static size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userData) {
     InternalResponse* res = (InternalResponse*) userData;
     size_t headerSize = size * nitems;
 
-    char* headerName = strndup(buffer, headerSize);
-    char* split = strchr(headerName, ':');
-    if (split) {
-        *split = 0;
-        split++;
-        while (*split == ' ') {
-            split++;
-        }
-        char* headerValue = strdup(split);
-
-        char* cr = strchr(headerValue, 13);
-        if (cr) {
-            *cr = 0;
-        }
+    // the blank line ends a header block
+    if (headerSize <= 2 && (buffer[0] == '\r' || buffer[0] == '\n')) {
+        long code = 0;
+        curl_easy_getinfo(res->curl, CURLINFO_RESPONSE_CODE, &code);
+        res->code = (int)code;
+        notifyHeaders(res);
+        return headerSize;
+    }
 
-        char* lf = strchr(headerValue, 10);
-        if (lf) {
-            *lf = 0;
-        }
+    // a status line starts a new block (after a redirect or a 100), its well known headers start over
+    if (headerSize > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        res->resumed |= resumedSession(res->curl);
+        memset(&res->headerInfo, 0, sizeof(naettHeaderInfo));
+        res->headerInfo.contentLength = -1;
+        return headerSize;
+    }
 
-        naettAlloc(KVLink, node);
-        node->next = res->headers;
-        node->key = headerName;
-        node->value = headerValue;
-        res->headers = node;
+    // straight from curl's buffer into the header table, the status line has no colon
+    const char* split = memchr(buffer, ':', headerSize);
+    if (split) {
+        addHeader(res, buffer, split - buffer, split + 1, headerSize - (split + 1 - buffer));
     }
 
     return headerSize;
 }
 
-void naettPlatformMakeRequest(InternalResponse* res) {
-    ssize_t nwrit;
+// everything but handing the handle over to its worker
+static void setupHandle(CURL* c, InternalResponse* res) {
     InternalRequest* req = res->request;
 
-    CURL* c = curl_easy_init();
     curl_easy_setopt(c, CURLOPT_URL, req->url);
     curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, req->options.timeoutMS);
 
@@ -934,44 +1707,82 @@ void naettPlatformMakeRequest(InternalResponse* res) {
 
     curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1);
 
+    setupHTTPVersion(c);
+    curl_easy_setopt(c, CURLOPT_SHARE, share);
+    long dnsTimeout = naettConfigValue(naettConfigDNSCacheTimeout);
+    if (dnsTimeout != 0) {
+        curl_easy_setopt(c, CURLOPT_DNS_CACHE_TIMEOUT, dnsTimeout < 0 ? -1L : dnsTimeout);
+    }
+
     int bodySize = res->request->options.bodyReader(NULL, 0, res->request->options.bodyReaderData);
     curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, bodySize);
 
     setupMethod(c, req->options.method);
 
-    struct curl_slist* headerList = NULL;
-    headerList = curl_slist_append(headerList, "User-Agent: Naett/1.0");
-
-    KVLink* header = req->options.headers;
-    size_t bufferSize = 0;
-    char* buffer = NULL;
-    while (header) {
-        size_t headerLength = strlen(header->key) + strlen(header->value) + 1 + 1;  // colon + null
-        if (headerLength > bufferSize) {
-            bufferSize = headerLength;
-            buffer = (char*)realloc(buffer, bufferSize);
-        }
-        snprintf(buffer, bufferSize, "%s:%s", header->key, header->value);
-        headerList = curl_slist_append(headerList, buffer);
-        header = header->next;
-    }
-    curl_easy_setopt(c, CURLOPT_HTTPHEADER, headerList);
-    free(buffer);
-    res->headerList = headerList;
+    curl_easy_setopt(c, CURLOPT_HTTPHEADER, req->headerList);
+    res->curl = c;
 
     curl_easy_setopt(c, CURLOPT_PRIVATE, res);
+}
 
-    nwrit = write(handleWriteFD, &c, sizeof(c));
-    if (nwrit != sizeof(c)) {
-        
+void naettPlatformMakeRequest(InternalResponse* res) {
+    CurlWorker* w = workerForURL(res->request->url);
+    CURL* c;
+    takeHandles(w, &c, 1);
+    setupHandle(c, res);
+    queueHandles(w, &c, 1);
+}
+
+// the transfers are grouped by worker, so each worker's lock is taken twice and it is woken
+// once for its whole share, however many there are
+void naettPlatformMakeMany(InternalResponse** responses, int count) {
+    CURL** handles = (CURL**)malloc(sizeof(CURL*) * count);
+    CurlWorker** owners = (CurlWorker**)malloc(sizeof(CurlWorker*) * count);
+    InternalResponse** group = (InternalResponse**)malloc(sizeof(InternalResponse*) * count);
+    if (handles == NULL || owners == NULL || group == NULL) {
+        free(handles);
+        free(owners);
+        free(group);
+        for (int i = 0; i < count; i++) {
+            naettPlatformMakeRequest(responses[i]);
+        }
+        return;
     }
+
+    for (int i = 0; i < count; i++) {
+        owners[i] = workerForURL(responses[i]->request->url);
+    }
+    for (int k = 0; k < workerCount; k++) {
+        CurlWorker* w = &workers[k];
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (owners[i] == w) {
+                group[n++] = responses[i];
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        takeHandles(w, handles, n);
+        for (int i = 0; i < n; i++) {
+            setupHandle(handles[i], group[i]);
+        }
+        queueHandles(w, handles, n);
+    }
+
+    free(handles);
+    free(owners);
+    free(group);
 }
 
 void naettPlatformFreeRequest(InternalRequest* req) {
+    // built by hand in one piece, see naettPlatformInitRequest(), unless it is the base request's
+    if (req->base == NULL || req->headerList != req->base->headerList) {
+        free(req->headerList);
+    }
 }
 
 void naettPlatformCloseResponse(InternalResponse* res) {
-    curl_slist_free_all(res->headerList);
 }
 
 #endif
@@ -1027,15 +1838,15 @@ static LPWSTR wcsndup(LPCWSTR str, size_t len) {
 }
 
 static LPCWSTR packHeaders(InternalRequest* req) {
-    char* packed = strdup("");
-
-    KVLink* node = req->options.headers;
-    while (node != NULL) {
-        char* update;
-        ASPRINTF(&update, "%s%s:%s%s", packed, node->key, node->value, node->next ? "\r\n" : "");
-        free(packed);
-        packed = update;
-        node = node->next;
+    // the same bytes as the pack, with ":" and "\r\n" in place of the terminators
+    HeaderPack* pack = &req->options.headers;
+    char* packed = (char*)malloc(pack->used + pack->count + 1);
+    char* end = packed;
+    *end = 0;
+
+    const char *key, *value;
+    for (const char* at = nextHeader(pack, NULL, &key, &value); at != NULL; at = nextHeader(pack, at, &key, &value)) {
+        end += sprintf(end, "%s%s:%s", end == packed ? "" : "\r\n", key, value);
     }
 
     LPCWSTR winHeaders = winFromUTF8(packed);
@@ -1049,16 +1860,7 @@ static void unpackHeaders(InternalResponse* res, LPWSTR packed) {
         char* header = winToUTF8(packed);
         char* split = strchr(header, ':');
         if (split) {
-            *split = 0;
-            split++;
-            while (*split == ' ') {
-                split++;
-            }
-            naettAlloc(KVLink, node);
-            node->key = strdup(header);
-            node->value = strdup(split);
-            node->next = res->headers;
-            res->headers = node;
+            addHeader(res, header, split - header, split + 1, strlen(split + 1));
         }
         free(header);
         packed += len + 1;
@@ -1101,10 +1903,11 @@ static void callback(HINTERNET request,
                 &statusCodeSize,
                 WINHTTP_NO_HEADER_INDEX);
             res->code = statusCode;
+            notifyHeaders(res);
 
             if (!WinHttpQueryDataAvailable(request, NULL)) {
                 res->code = naettProtocolError;
-                res->complete = 1;
+                markComplete(res);
             }
         } break;
 
@@ -1112,14 +1915,14 @@ static void callback(HINTERNET request,
             DWORD* available = (DWORD*)statusInformation;
             res->bytesLeft = *available;
             if (res->bytesLeft == 0) {
-                res->complete = 1;
+                markComplete(res);
                 break;
             }
 
             size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
             if (!WinHttpReadData(request, res->buffer, bytesToRead, NULL)) {
                 res->code = naettReadError;
-                res->complete = 1;
+                markComplete(res);
             }
         } break;
 
@@ -1129,7 +1932,7 @@ static void callback(HINTERNET request,
             InternalRequest* req = res->request;
             if (req->options.bodyWriter(res->buffer, bytesRead, req->options.bodyWriterData) != bytesRead) {
                 res->code = naettReadError;
-                res->complete = 1;
+                markComplete(res);
             }
 
             res->bytesLeft -= bytesRead;
@@ -1137,12 +1940,12 @@ static void callback(HINTERNET request,
                 size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
                 if (!WinHttpReadData(request, res->buffer, bytesToRead, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    markComplete(res);
                 }
             } else {
                 if (!WinHttpQueryDataAvailable(request, NULL)) {
                     res->code = naettProtocolError;
-                    res->complete = 1;
+                    markComplete(res);
                 }
             }
         } break;
@@ -1156,7 +1959,7 @@ static void callback(HINTERNET request,
             } else {
                 if (!WinHttpReceiveResponse(request, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    markComplete(res);
                 }
             }
         } break;
@@ -1180,7 +1983,7 @@ static void callback(HINTERNET request,
                     res->code = naettGenericError;
             }
 
-            res->complete = 1;
+            markComplete(res);
         } break;
     }
 }
@@ -1263,7 +2066,7 @@ void naettPlatformMakeRequest(InternalResponse* res) {
 
     if (!WinHttpSendRequest(req->request, extraHeaders, -1, NULL, 0, 0, (DWORD_PTR)res)) {
         res->code = naettConnectionError;
-        res->complete = 1;
+        markComplete(res);
     }
 }
 
@@ -1422,14 +2225,14 @@ static void* processRequest(void* data) {
         (*env)->DeleteLocalRef(env, value);
     }
 
-    KVLink* header = req->options.headers;
-    while (header != NULL) {
-        jstring name = (*env)->NewStringUTF(env, header->key);
-        jstring value = (*env)->NewStringUTF(env, header->value);
+    const char *key, *headerValue;
+    for (const char* at = nextHeader(&req->options.headers, NULL, &key, &headerValue); at != NULL;
+         at = nextHeader(&req->options.headers, at, &key, &headerValue)) {
+        jstring name = (*env)->NewStringUTF(env, key);
+        jstring value = (*env)->NewStringUTF(env, headerValue);
         voidCall(env, connection, "addRequestProperty", "(Ljava/lang/String;Ljava/lang/String;)V", name, value);
         (*env)->DeleteLocalRef(env, name);
         (*env)->DeleteLocalRef(env, value);
-        header = header->next;
     }
 
     jobject outputStream = NULL;
@@ -1489,11 +2292,7 @@ static void* processRequest(void* data) {
         jstring value = call(env, values, "get", "(I)Ljava/lang/Object;", 0);
         const char* valueString = (*env)->GetStringUTFChars(env, value, NULL);
 
-        naettAlloc(KVLink, node);
-        node->key = strdup(nameString);
-        node->value = strdup(valueString);
-        node->next = res->headers;
-        res->headers = node;
+        addHeader(res, nameString, strlen(nameString), valueString, strlen(valueString));
 
         (*env)->ReleaseStringUTFChars(env, name, nameString);
         (*env)->ReleaseStringUTFChars(env, value, valueString);
@@ -1504,6 +2303,8 @@ static void* processRequest(void* data) {
     }
 
     int statusCode = intCall(env, connection, "getResponseCode", "()I");
+    res->code = statusCode;
+    notifyHeaders(res);
 
     jobject inputStream = NULL;
 
@@ -1536,7 +2337,7 @@ static void* processRequest(void* data) {
     res->code = statusCode;
 
 finally:
-    res->complete = 1;
+    markComplete(res);
     (*env)->PopLocalFrame(env, NULL);
     JavaVM* vm = getVM();
     (*env)->ExceptionClear(env);
@@ -20,6 +20,73 @@ typedef void* naettInitData;
  */
 void naettInit(naettInitData initThing);
 
+enum naettConfigOption {
+    // Linux transfer loop, one of `naettBackend`.
+    naettConfigBackend = 1,
+    // Linux transfer threads, requests are spread over them by host. 0 picks one per processor.
+    naettConfigWorkers,
+    // Linux idle curl handles each transfer thread keeps for reuse. 0 picks the default (32), < 0 disables.
+    naettConfigHandlePool,
+    // Linux seconds resolved hosts stay cached, shared by all transfer threads. 0 keeps curl's default (60), < 0 forever.
+    naettConfigDNSCacheTimeout,
+    // Linux idle connections each transfer thread keeps open for reuse. 0 keeps curl's default.
+    naettConfigMaxConnects,
+    // Linux HTTP version, one of `naettHTTPVersion`.
+    naettConfigHTTPVersion,
+    // Linux HTTP/2 streams multiplexed over one connection. 0 keeps curl's default (100).
+    naettConfigMaxStreams,
+    // Linux connections per host, 0 is unlimited. Hosts stick to one transfer thread, so this holds overall.
+    naettConfigMaxHostConnections,
+    // Linux connections per transfer thread, 0 is unlimited.
+    naettConfigMaxTotalConnections,
+    // Linux HTTP/2 stream weight (1-256) for every request. 0 keeps the default (16).
+    naettConfigStreamWeight,
+    naettConfigCount,
+};
+
+enum naettHTTPVersion {
+    // whatever curl picks
+    naettHTTPDefault = 0,
+    // HTTP/1.1 only
+    naettHTTP1 = 1,
+    // HTTP/2 when the TLS handshake agrees on it, requests to a host share one connection
+    naettHTTP2 = 2,
+    // HTTP/2 without asking, plain http too (h2c), for servers known to speak it
+    naettHTTP2PriorKnowledge = 3,
+};
+
+enum naettBackend {
+    // curl_multi_perform() + curl_multi_poll(), rescans every transfer per wakeup
+    naettBackendPoll = 0,
+    // curl_multi_socket_action() driven by epoll, cost per wakeup scales with active sockets
+    naettBackendEpoll = 1,
+};
+
+/**
+ * @brief Sets a global transport option.
+ * Must be called before `naettInit`, options not supported by the
+ * platform are ignored.
+ */
+void naettConfigure(int option, long value);
+
+typedef struct {
+    // Finished transfers.
+    long long transfers;
+    // Transfers that had to open a new connection, the rest reused one.
+    long long connections;
+    // Time spent in TLS handshakes on new connections, in microseconds.
+    long long handshakeMicroseconds;
+    // New TLS connections that resumed a cached session (an abbreviated handshake).
+    // Only counted when curl uses OpenSSL and its libssl is found at init, otherwise stays 0.
+    long long resumedSessions;
+} naettStats;
+
+/**
+ * @brief Reads the transport counters kept since `naettInit`.
+ * Only the Linux backend records these, elsewhere they stay zero.
+ */
+void naettGetStats(naettStats* stats);
+
 typedef struct naettReq naettReq;
 typedef struct naettRes naettRes;
 // If naettReadFunc is called with NULL dest, it must respond with the body size
@@ -27,6 +94,18 @@ typedef int (*naettReadFunc)(void* dest, int bufferSize, void* userData);
 typedef int (*naettWriteFunc)(const void* source, int bytes, void* userData);
 typedef int (*naettHeaderLister)(const char* name, const char* value, void* userData);
 
+enum naettEvent {
+    // The status code and a full block of response headers are available.
+    // Sent once per block, so redirects can send it more than once.
+    naettEventHeaders = 1,
+    // The response is complete, with a result or an error.
+    naettEventComplete = 2,
+};
+
+// Called on the transport thread when a response changes state, see `naettEvent`.
+// Must be quick and must not close the response.
+typedef void (*naettEventFunc)(int event, naettRes* response, void* userData);
+
 // Option to `naettRequest`
 typedef struct naettOption naettOption;
 
@@ -34,6 +113,10 @@ typedef struct naettOption naettOption;
 naettOption* naettMethod(const char* method);
 // Adds a request header.
 naettOption* naettHeader(const char* name, const char* value);
+// Adds count request headers at once from a string pool, header i has its name
+// at pool + offsets[i * 2] and its value at pool + offsets[i * 2 + 1].
+// The strings are copied once, into the request's own packed header block.
+naettOption* naettHeaderBlock(int count, const char* pool, const unsigned int* offsets);
 // Sets the request body. Ignored if a body reader is configured.
 // The body is not copied, and the passed pointer must be valid for the
 // lifetime of the request.
@@ -44,6 +127,8 @@ naettOption* naettBodyReader(naettReadFunc reader, void* userData);
 naettOption* naettBodyWriter(naettWriteFunc writer, void* userData);
 // Sets connection timeout in milliseconds.
 naettOption* naettTimeout(int milliSeconds);
+// Sets a handler for response state changes.
+naettOption* naettEventHandler(naettEventFunc handler, void* userData);
 
 /**
  * @brief Creates a new request to the specified url.
@@ -57,6 +142,15 @@ naettOption* naettTimeout(int milliSeconds);
  */
 naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOption** options);
 
+/**
+ * @brief Creates a new request that starts out as a copy of `base`
+ * (method, headers, body and timeout), with the options applied on top.
+ * A NULL url keeps the base's url. What the platform already built for
+ * the base is shared where it can be (the Linux header list), so the
+ * base must outlive every request made from it.
+ */
+naettReq* naettRequestFrom(naettReq* base, const char* url, int numOptions, const naettOption** options);
+
 /**
  * @brief Makes a request and returns a response object.
  * The actual request is processed asynchronously, use `naettComplete`
@@ -67,6 +161,13 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
  */
 naettRes* naettMake(naettReq* request);
 
+/**
+ * @brief Makes `count` requests at once, `responses` gets theirs in the
+ * same order. Where requests go to transfer threads (Linux) each thread
+ * gets its share in one go, with one wakeup, rather than one per request.
+ */
+void naettMakeMany(naettReq* const* requests, naettRes** responses, int count);
+
 /**
  * @brief Frees a previously allocated request object.
  * The request must not have any pending responses.
@@ -110,8 +211,26 @@ const void* naettGetBody(naettRes* response, int* outSize);
 const char* naettGetHeader(naettRes* response, const char* name);
 
 /**
- * @brief Enumerates all response headers as long as the `lister`
- * returns true.
+ * @brief Well known response headers, parsed as they arrive.
+ * Fields are NULL (or -1 for the length) until the header is seen,
+ * a later header block (after a redirect) starts them over.
+ */
+typedef struct {
+    long long contentLength;
+    const char* contentType;
+    const char* etag;
+    const char* cacheControl;
+    const char* location;
+} naettHeaderInfo;
+
+/**
+ * @brief Returns the well known headers of a response.
+ */
+const naettHeaderInfo* naettGetHeaderInfo(naettRes* response);
+
+/**
+ * @brief Enumerates all response headers in arrival order as long
+ * as the `lister` returns true.
  */
 void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userData);
 
@@ -117,6 +117,8 @@ int xthread_join(pthread_t thread, xthread_ret *retval) {
 
 #else
 
+#include <sys/time.h>
+
 #ifdef __APPLE__
 
 #include <unistd.h>
@@ -144,12 +146,30 @@ int xthread_join(pthread_t thread, xthread_ret *retval) {
     return pthread_join(thread, retval);
 }
 
+// pthread_cond_timedwait() wants an absolute CLOCK_REALTIME time, so add to the current time of day
+void ms_to_timespec(struct timespec *ts, unsigned int ms) {
+    struct timeval now;
+    if (ts == NULL)
+        return;
+    gettimeofday(&now, NULL);
+    ts->tv_sec = now.tv_sec + (ms / 1000);
+    ts->tv_nsec = (now.tv_usec * 1000) + (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
 
 #endif
 
+#ifdef _WIN32
+
+// the win32 timespec_to_ms() above reads this back relative to time(NULL)
 void ms_to_timespec(struct timespec *ts, unsigned int ms) {
     if (ts == NULL)
         return;
     ts->tv_sec = (ms / 1000) + time(NULL);
     ts->tv_nsec = (ms % 1000) * 1000000;
 }
+
+#endif
@@ -59,6 +59,20 @@ int xthread_join(pthread_t thread, xthread_ret *retval);
 
 #endif
 
+// *****************************************************************************************************
+// atomics, GCC/clang builtins (every platform build uses clang)
+#define xatomic_load(p)             __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define xatomic_store(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define xatomic_add(p, v)           __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define xatomic_sub(p, v)           __atomic_fetch_sub((p), (v), __ATOMIC_ACQ_REL)
+#define xatomic_exchange(p, v)      __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+// on failure *expected is updated with the current value
+#define xatomic_cas(p, expected, v) __atomic_compare_exchange_n((p), (expected), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define xatomic_or(p, v)           __atomic_fetch_or((p), (v), __ATOMIC_ACQ_REL)
+#define xatomic_fence()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+// thread local storage, clang takes __thread on every target
+#define xthread_local               __thread
+
 // *****************************************************************************************************
 // utilities
 unsigned int pcthread_get_num_procs();
@@ -0,0 +1,224 @@
+/*
+	benchmark program for libhttps dynamic library
+	Jason A. Petrasko 2022, MIT License
+
+	point it at a loopback server, for example:
+		python3 -m http.server 8000 &
+		./bench latency -n 200 http://127.0.0.1:8000/
+		./bench throughput -n 5000 -c 64 -w 4 https://127.0.0.1:8443/ https://127.0.0.2:8443/ https://127.0.0.3:8443/
+		./bench repeat -n 2000 -p -1 http://127.0.0.1:8000/ (then again without -p to compare the handle pool)
+		./bench repeat -n 2000 -t 1 http://127.0.0.1:8000/ (fired from a prepared template instead of httpsGet())
+		./bench burst -n 200 -m 1 http://127.0.0.1:8000/a http://127.0.0.1:8000/b (one batch, then again without -m to compare)
+		./bench burst -n 200 -a 16 http://127.0.0.1:8000/ (only 16 running at a time, the rest wait in the admission queue)
+*/
+
+#define _DEFAULT_SOURCE 1
+
+#include "https.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static int compareDouble(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char *what, double *ms, int n) {
+	double sum = 0.0;
+	qsort(ms, n, sizeof(double), compareDouble);
+	for (int i = 0; i < n; i++) sum += ms[i];
+	printf("%s over %d requests (ms): min %.3f  avg %.3f  p50 %.3f  p99 %.3f  max %.3f\n", what, n,
+		ms[0], sum / n, ms[n / 2], ms[(n * 99) / 100], ms[n - 1]);
+}
+
+// connection reuse over the whole run (a reused connection skips tcp and tls setup), and how many
+// of the new tls connections resumed a session instead of a full handshake
+static void reportConnections() {
+	httpsSystemInfo info;
+	httpsGetInfo(&info);
+	if (info.transfers == 0) return;
+	printf("%lld transfers, %lld connections reused, %lld new connections, %lld tls sessions resumed, %.3f ms avg tls handshake\n",
+		info.transfers, info.transfers - info.newConnections, info.newConnections, info.resumedSessions,
+		info.newConnections ? (info.handshakeSeconds * 1000.0) / info.newConnections : 0.0);
+}
+
+// read buffers recycled by the pool, in steady state every request should be a hit
+static void reportPool() {
+	httpsSystemInfo info;
+	httpsGetInfo(&info);
+	long long total = info.poolHits + info.poolMisses;
+	if (total == 0) return;
+	printf("%lld buffers from the pool, %lld from malloc, %.1f%% hit rate\n",
+		info.poolHits, info.poolMisses, (info.poolHits * 100.0) / total);
+}
+
+// time from httpsGet() to the first body byte landing in the request buffer, one request at a time
+static int benchLatency(const char *url, int count) {
+	double *ms = calloc(count, sizeof(double));
+	for (int i = 0; i < count; i++) {
+		double start = now();
+		void *r = httpsGet(url, 0, NULL);
+		if (r == NULL) {
+			printf("request %d failed to start\n", i);
+			return 1;
+		}
+		while ((httpsGetBodyLength(r) == 0) && !httpsIsComplete(r)) httpsUpdate();
+		ms[i] = (now() - start) * 1000.0;
+		while (!httpsIsComplete(r)) httpsUpdate();
+		httpsRelease(r);
+		httpsUpdate();
+	}
+	report("submit to first byte", ms, count);
+	reportConnections();
+	reportPool();
+	free(ms);
+	return 0;
+}
+
+// what the library learned about each endpoint's response size
+static void reportEstimates() {
+	httpsSizeEstimate est[8];
+	int n = httpsGetSizeEstimates(est, 8);
+	for (int i = 0; (i < n) && (i < 8); i++)
+		printf("%s: %u samples, %.0f bytes avg (+/- %.0f), requests start at %lu bytes\n", est[i].endpoint,
+			est[i].samples, est[i].meanBytes, est[i].deviationBytes, est[i].initialBytes);
+}
+
+// the same endpoint over and over like a polling client: the cost of httpsGet() (or httpsFire()) itself, and the whole round trip
+static int benchRepeat(const char *url, int count, int prepare) {
+	double *submit = calloc(count, sizeof(double));
+	double *total = calloc(count, sizeof(double));
+	void *t = prepare ? httpsPrepare(url, "GET", NULL, NULL, 0) : NULL;
+	if (prepare && (t == NULL)) {
+		printf("could not prepare %s\n", url);
+		return 1;
+	}
+	for (int i = 0; i < count; i++) {
+		double start = now();
+		void *r = (t != NULL) ? httpsFire(t, 0, NULL, NULL, 0) : httpsGet(url, 0, NULL);
+		submit[i] = (now() - start) * 1000.0;
+		if (r == NULL) {
+			printf("request %d failed to start\n", i);
+			return 1;
+		}
+		while (!httpsIsComplete(r)) httpsUpdate();
+		total[i] = (now() - start) * 1000.0;
+		httpsRelease(r);
+		httpsUpdate();
+	}
+	report((t != NULL) ? "httpsFire() call" : "httpsGet() call", submit, count);
+	httpsUnprepare(t);
+	report("round trip", total, count);
+	reportConnections();
+	reportPool();
+	reportEstimates();
+	free(submit);
+	free(total);
+	return 0;
+}
+
+// keep `window` requests in flight, round robin over the urls (use several hosts to spread over workers)
+static int benchThroughput(const char **urls, int urlCount, int count, int window) {
+	void **live = calloc(window, sizeof(void*));
+	int started = 0, finished = 0;
+	unsigned long bytes = 0;
+	double start = now();
+	while (finished < count) {
+		for (int i = 0; i < window; i++) {
+			if ((live[i] != NULL) && httpsIsComplete(live[i])) {
+				bytes += httpsGetBodyLength(live[i]);
+				httpsRelease(live[i]);
+				live[i] = NULL;
+				finished++;
+			}
+			if ((live[i] == NULL) && (started < count)) {
+				live[i] = httpsGet(urls[started % urlCount], 0, NULL);
+				if (live[i] == NULL) {
+					printf("request %d failed to start\n", started);
+					return 1;
+				}
+				started++;
+			}
+		}
+		httpsUpdate();
+	}
+	double secs = now() - start;
+	printf("%d requests, %d in flight, %d url(s): %.3f s, %.1f req/s, %.2f MB/s\n", count, window, urlCount,
+		secs, count / secs, (bytes / 1048576.0) / secs);
+	reportConnections();
+	reportPool();
+	free(live);
+	return 0;
+}
+
+// count gets submitted back to back like an asset load, one httpsGet() each or one httpsSubmitBatch(), then wait them all out
+static int benchBurst(const char **urls, int urlCount, int count, int batch) {
+	void **live = calloc(count, sizeof(void*));
+	const char **list = calloc(count, sizeof(const char*));
+	unsigned long bytes = 0;
+	int started = 0;
+	for (int i = 0; i < count; i++) list[i] = urls[i % urlCount];
+	double start = now();
+	if (batch) started = httpsSubmitBatch("GET", list, count, 0, NULL, live);
+	else for (int i = 0; i < count; i++) if ((live[i] = httpsGet(list[i], 0, NULL)) != NULL) started++;
+	double submitted = now();
+	for (int i = 0; i < count; i++) {
+		if (live[i] == NULL) continue;
+		while (!httpsIsComplete(live[i])) httpsUpdate();
+		bytes += httpsGetBodyLength(live[i]);
+		httpsRelease(live[i]);
+	}
+	double secs = now() - start;
+	printf("%d of %d requests started with %s: %.3f ms to submit (%.2f us each), %.3f s to finish, %.2f MB/s\n", started, count,
+		batch ? "httpsSubmitBatch()" : "httpsGet()", (submitted - start) * 1000.0, ((submitted - start) * 1000000.0) / count,
+		secs, (bytes / 1048576.0) / secs);
+	reportConnections();
+	reportPool();
+	free(list);
+	free(live);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int count = 100, window = 32, prepare = 0, batch = 0, i;
+	if (argc < 3) {
+		printf("bench usage: bench <latency|throughput|repeat|burst> [-n count] [-c in flight] [-b poll|epoll] [-w workers] [-p handle pool] [-d dns ttl] [-k kept connections] [-h http 0-3] [-s h2 streams] [-t fire from a template] [-m submit as one batch] [-a active limit] <url> [url ...]\n");
+		return 0;
+	}
+	for (i = 2; (i < argc - 1) && (argv[i][0] == '-'); i += 2) {
+		if (!strcmp(argv[i], "-n")) count = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-c")) window = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-b")) easyOptionUI(EASY_OPT_BACKEND, !strcmp(argv[i + 1], "epoll"));
+		else if (!strcmp(argv[i], "-w")) easyOptionUI(EASY_OPT_WORKERS, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-p")) easyOptionD(EASY_OPT_HANDLES, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-d")) easyOptionD(EASY_OPT_DNS_TTL, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-k")) easyOptionUI(EASY_OPT_CONNECTIONS, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-h")) easyOptionUI(EASY_OPT_HTTP, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-s")) easyOptionUI(EASY_OPT_STREAMS, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-t")) prepare = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-m")) batch = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-a")) easyOptionUI(EASY_OPT_ACTIVE, atoi(argv[i + 1]));
+	}
+	if (i >= argc) {
+		printf("no url given\n");
+		return 1;
+	}
+	if (count < 1) count = 1;
+	if (window < 1) window = 1;
+	httpsInit(NULL, 0);
+	if (!strcmp(argv[1], "latency")) return benchLatency(argv[i], count);
+	if (!strcmp(argv[1], "repeat")) return benchRepeat(argv[i], count, prepare);
+	if (!strcmp(argv[1], "burst")) return benchBurst((const char**)&argv[i], argc - i, count, batch);
+	if (!strcmp(argv[1], "throughput")) return benchThroughput((const char**)&argv[i], argc - i, count, window);
+	printf("unknown benchmark '%s'\n", argv[1]);
+	return 1;
+}